@@ -0,0 +1,579 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <VkBootstrap.h>
+#include <glm/gtc/matrix_transform.hpp>
+#include <spdlog/spdlog.h>
+
+#include "engine/library.hpp"
+#include "engine/rendering.hpp"
+
+using namespace b;
+
+struct BenchConfig {
+  uint32_t frames = 1000;
+  uint32_t warmup_frames = 100;
+  uint32_t draws = 1;
+  // Non-zero switches to the GPU-driven path with that many objects
+  uint32_t objects = 0;
+  // Instanced quads pushed every frame and drawn with a single call
+  uint32_t instances = 0;
+  // Non-zero runs the mesh optimizer on the scene mesh
+  uint32_t optimize = 0;
+  // Meshes added and removed again every frame, memory has to stay flat
+  uint32_t stream = 0;
+  // Non-zero records the scene every frame on that many threads
+  uint32_t threads = 0;
+  // Non-zero repeats the run for 1, 2, 4... threads up to the core count
+  uint32_t scaling = 0;
+  // Non-zero frustum culls the scene draws on the CPU, spread over a grid
+  // three times the size of the viewport
+  uint32_t cpu_cull = 0;
+  // Non-zero only measures the CPU culling kernels on that many objects
+  uint32_t cull = 0;
+  // Non-zero occlusion culls the GPU-driven scene
+  uint32_t occlusion = 0;
+  // Depth layers the GPU-driven objects are spread over, the front one
+  // hides the others
+  uint32_t layers = 1;
+  uint32_t frames_in_flight = 2;
+  uint32_t width = 1024;
+  uint32_t height = 1024;
+  // GPU profiler export, .csv or .json
+  const char *profile_path = nullptr;
+  // Mesh file written by sbox-mesh-convert, drawn instead of the quad
+  const char *mesh_path = nullptr;
+  // Memory telemetry, dumped periodically and once more at the end
+  const char *memory_dump_path = nullptr;
+  // Delete the file to measure a cold start
+  const char *pipeline_cache_path = "./build/pipeline_cache.bin";
+
+  void parse(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+      CHECK_REPORT_FMT(i + 1 < argc, "Missing value for {}", argv[i]);
+      uint32_t value = std::strtoul(argv[i + 1], nullptr, 10);
+
+      if (std::strcmp(argv[i], "--frames") == 0)
+        frames = value;
+      else if (std::strcmp(argv[i], "--warmup") == 0)
+        warmup_frames = value;
+      else if (std::strcmp(argv[i], "--draws") == 0)
+        draws = value;
+      else if (std::strcmp(argv[i], "--objects") == 0)
+        objects = value;
+      else if (std::strcmp(argv[i], "--instances") == 0)
+        instances = value;
+      else if (std::strcmp(argv[i], "--optimize") == 0)
+        optimize = value;
+      else if (std::strcmp(argv[i], "--stream") == 0)
+        stream = value;
+      else if (std::strcmp(argv[i], "--threads") == 0)
+        threads = value;
+      else if (std::strcmp(argv[i], "--scaling") == 0)
+        scaling = value;
+      else if (std::strcmp(argv[i], "--cpu-cull") == 0)
+        cpu_cull = value;
+      else if (std::strcmp(argv[i], "--cull") == 0)
+        cull = value;
+      else if (std::strcmp(argv[i], "--occlusion") == 0)
+        occlusion = value;
+      else if (std::strcmp(argv[i], "--layers") == 0)
+        layers = value;
+      else if (std::strcmp(argv[i], "--frames-in-flight") == 0)
+        frames_in_flight = value;
+      else if (std::strcmp(argv[i], "--width") == 0)
+        width = value;
+      else if (std::strcmp(argv[i], "--height") == 0)
+        height = value;
+      else if (std::strcmp(argv[i], "--profile") == 0)
+        profile_path = argv[i + 1];
+      else if (std::strcmp(argv[i], "--pipeline-cache") == 0)
+        pipeline_cache_path = argv[i + 1];
+      else if (std::strcmp(argv[i], "--mesh") == 0)
+        mesh_path = argv[i + 1];
+      else if (std::strcmp(argv[i], "--memory-dump") == 0)
+        memory_dump_path = argv[i + 1];
+      else
+        CHECK_REPORT_FMT(false, "Unknown argument {}", argv[i]);
+
+      i++;
+    }
+
+    CHECK_REPORT_STR(frames > 0, "At least one frame must be measured");
+    CHECK_REPORT_STR(layers > 0, "At least one layer is needed");
+  }
+};
+
+// Grids of quads spanning a bit more than the viewport, so the outer ring of
+// objects gets culled. With several layers each one is further away and the
+// quads touch, so the front layer occludes everything behind it.
+void populate_gpu_scene(engine::GpuScene &scene, const engine::Mesh &mesh,
+                        uint32_t object_count, uint32_t layers) {
+  uint32_t layer_count = (object_count + layers - 1) / layers;
+  uint32_t side = std::ceil(std::sqrt((double)layer_count));
+  float extent = 3.0f;
+  float spacing = extent / side;
+  float fill = layers > 1 ? 1.0f : 0.8f;
+
+  for (uint32_t i = 0; i < object_count; i++) {
+    uint32_t cell = i % layer_count;
+    float depth = layers > 1 ? 0.1f + 0.8f * (i / layer_count) / layers : 0.0f;
+    glm::vec3 position = {-extent / 2 + spacing * (cell % side + 0.5f),
+                          -extent / 2 + spacing * (cell / side + 0.5f), depth};
+    glm::mat4 transform = glm::translate(glm::mat4(1.0f), position);
+    transform = glm::scale(transform, glm::vec3(spacing * fill));
+
+    scene.add_object(mesh, transform, {0.0f, 0.0f, 0.0f, std::sqrt(0.5f)});
+  }
+}
+
+// Quad `i` of a grid of `count` spanning `extent` around the origin
+glm::mat4 grid_transform(uint32_t i, uint32_t count, float extent) {
+  uint32_t side = std::ceil(std::sqrt((double)count));
+  float spacing = extent / side;
+  glm::vec3 position = {-extent / 2 + spacing * (i % side + 0.5f),
+                        -extent / 2 + spacing * (i / side + 0.5f), 0.0f};
+  glm::mat4 transform = glm::translate(glm::mat4(1.0f), position);
+  return glm::scale(transform, glm::vec3(spacing * 0.8f));
+}
+
+// Circles every scene draw around its place, so every frame writes a
+// transform per draw like a scene of moving objects would. Depths are
+// scattered so the render queue has an order to sort. Culled draws are
+// spread over a grid and moved in the cull store instead.
+void move_scene_draws(engine::RenderData &render_data, uint32_t frame) {
+  uint32_t count = render_data.scene_draw_count;
+  glm::mat4 *transforms = render_data.cpu_culling
+                              ? nullptr
+                              : render_data.push_scene_transforms();
+  render_data.scene_depths.resize(count);
+  for (uint32_t i = 0; i < count; i++) {
+    float phase = (frame + i) * 0.05f;
+    glm::mat4 offset = glm::translate(
+        glm::mat4(1.0f),
+        glm::vec3(0.05f * std::cos(phase), 0.05f * std::sin(phase), 0.0f));
+    render_data.scene_depths[i] = 0.5f + 0.5f * std::sin(phase * 7.0f);
+
+    if (transforms)
+      transforms[i] = offset;
+    else
+      render_data.scene_objects.set_transform(
+          i, offset * grid_transform(i, count, 3.0f));
+  }
+}
+
+// Grid of quads covering the viewport, spinning with the frame number
+void push_instances(engine::InstanceBuffer &instances, const engine::Mesh &mesh,
+                    uint32_t instance_count, uint32_t frame) {
+  uint32_t side = std::ceil(std::sqrt((double)instance_count));
+  float spacing = 2.0f / side;
+  float rotation = frame * 0.01f;
+
+  engine::Instance *out = instances.push(mesh, instance_count);
+  for (uint32_t i = 0; i < instance_count; i++) {
+    uint32_t x = i % side;
+    uint32_t y = i / side;
+
+    engine::Instance instance;
+    instance.translation = {-1.0f + spacing * (x + 0.5f),
+                            -1.0f + spacing * (y + 0.5f)};
+    instance.scale = {spacing * 0.8f, spacing * 0.8f};
+    instance.rotation = rotation;
+    instance.color = 0xff000000 | ((y * 255 / side) << 8) | (x * 255 / side);
+    out[i] = instance;
+  }
+}
+
+double percentile(std::vector<double> samples, double p) {
+  if (samples.empty())
+    return 0.0;
+
+  size_t n = (size_t)(p * (samples.size() - 1));
+  std::nth_element(samples.begin(), samples.begin() + n, samples.end());
+  return samples[n];
+}
+
+// Bytes per texel of the formats a swapchain or the headless target uses
+uint32_t color_format_size(VkFormat format) {
+  switch (format) {
+  case VK_FORMAT_R16G16B16A16_SFLOAT:
+    return 8;
+  default:
+    // 8-bit RGBA and BGRA, and packed 10-bit formats
+    return 4;
+  }
+}
+
+// Bytes per texel of the depth formats DepthPyramid picks from
+uint32_t depth_format_size(VkFormat format) {
+  return format == VK_FORMAT_D16_UNORM ? 2 : 4;
+}
+
+// Mebibytes of a full target of `texel_size` bytes per texel
+double target_mib(engine::BootstrapInfo &bootstrap, uint32_t texel_size) {
+  VkExtent2D extent = bootstrap.extent();
+  return (double)extent.width * extent.height * texel_size / (1 << 20);
+}
+
+struct Measurement {
+  std::vector<double> cpu_frame_times;
+  std::vector<double> gpu_frame_times;
+  std::vector<double> record_times;
+  std::vector<double> sort_times;
+  std::vector<double> cull_times;
+  std::vector<double> scene_gpu_times;
+  // Render queue binds of the last frame
+  uint32_t binds = 0;
+  uint32_t binds_avoided = 0;
+  double total_s = 0.0;
+  // Command buffers allocated during the measured frames, zero once the
+  // per-frame rings have warmed up
+  size_t command_buffer_allocations = 0;
+  // From the startup time point to the end of the first frame
+  double first_frame_ms = 0.0;
+  // Arena pages alive and destructions still deferred after the last frame
+  size_t arena_pages = 0;
+  size_t pending_deletions = 0;
+};
+
+// Replaces the meshes streamed in the previous frame with `count` new ones
+void stream_meshes(engine::BootstrapInfo &bootstrap, engine::Library &library,
+                   std::vector<engine::Mesh> &streamed, uint32_t count) {
+  for (auto &mesh : streamed)
+    library.remove_mesh(bootstrap, mesh);
+  streamed.clear();
+
+  for (uint32_t i = 0; i < count; i++)
+    streamed.push_back(library.add_mesh(
+        bootstrap,
+        std::vector(engine::VERTICES.cbegin(), engine::VERTICES.cend()),
+        std::vector(engine::INDICES.cbegin(), engine::INDICES.cend())));
+  if (count > 0)
+    library.flush_uploads(bootstrap);
+}
+
+Measurement measure(engine::BootstrapInfo &bootstrap,
+                    engine::RenderData &render_data, engine::Library &library,
+                    const BenchConfig &config,
+                    std::chrono::steady_clock::time_point startup) {
+  using clock = std::chrono::steady_clock;
+
+  Measurement measurement;
+  measurement.cpu_frame_times.reserve(config.frames);
+  measurement.gpu_frame_times.reserve(config.frames);
+  measurement.record_times.reserve(config.frames);
+  measurement.sort_times.reserve(config.frames);
+  measurement.cull_times.reserve(config.frames);
+  measurement.scene_gpu_times.reserve(config.frames);
+
+  clock::time_point measure_start;
+  size_t allocated_command_buffers = 0;
+  std::vector<engine::Mesh> streamed;
+
+  for (uint32_t i = 0; i < config.warmup_frames + config.frames; i++) {
+    if (i == config.warmup_frames) {
+      measure_start = clock::now();
+      allocated_command_buffers = render_data.allocated_command_buffers();
+    }
+
+    auto frame_start = clock::now();
+
+    if (config.stream > 0)
+      stream_meshes(bootstrap, library, streamed, config.stream);
+
+    render_data.begin_frame(bootstrap);
+    if (config.instances > 0)
+      push_instances(render_data.instances, *engine::mesh, config.instances,
+                     i);
+    if (!render_data.gpu_driven)
+      move_scene_draws(render_data, i);
+
+    ImGui_ImplVulkan_NewFrame();
+    ImGui::NewFrame();
+    render_data.draw_frame(bootstrap);
+
+    auto frame_end = clock::now();
+    if (i == 0)
+      measurement.first_frame_ms =
+          std::chrono::duration<double, std::milli>(frame_end - startup)
+              .count();
+
+    if (i < config.warmup_frames)
+      continue;
+
+    measurement.cpu_frame_times.push_back(
+        std::chrono::duration<double, std::milli>(frame_end - frame_start)
+            .count());
+    if (render_data.profiler.enabled()) {
+      measurement.gpu_frame_times.push_back(
+          render_data.profiler.latest_ms("frame"));
+      measurement.scene_gpu_times.push_back(
+          render_data.profiler.latest_ms("scene"));
+    }
+    measurement.record_times.push_back(render_data.scene_record_ms);
+    measurement.sort_times.push_back(render_data.render_queue.stats.sort_ms);
+    measurement.cull_times.push_back(render_data.culler.stats.cull_ms);
+  }
+
+  stream_meshes(bootstrap, library, streamed, 0);
+  measurement.arena_pages = std::count_if(
+      library.arena.pages.begin(), library.arena.pages.end(),
+      [](auto &page) { return !engine::GeometryArena::is_released(page); });
+  measurement.pending_deletions = bootstrap.deletion_queue.entries.size();
+  measurement.binds = render_data.render_queue.stats.binds;
+  measurement.binds_avoided = render_data.render_queue.stats.binds_avoided;
+
+  bootstrap.dispatch.deviceWaitIdle();
+  measurement.total_s =
+      std::chrono::duration<double>(clock::now() - measure_start).count();
+  measurement.command_buffer_allocations =
+      render_data.allocated_command_buffers() - allocated_command_buffers;
+  return measurement;
+}
+
+// Runs the scene with a growing number of recording threads and reports the
+// recording time against the single threaded one
+void measure_scaling(engine::BootstrapInfo &bootstrap,
+                     engine::RenderData &render_data, engine::Library &library,
+                     const BenchConfig &config) {
+  uint32_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+  double single_thread_ms = 0.0;
+
+  for (uint32_t threads = 1; threads <= max_threads; threads *= 2) {
+    render_data.set_recording_threads(bootstrap, threads);
+    Measurement measurement = measure(bootstrap, render_data, library, config,
+                                      std::chrono::steady_clock::now());
+
+    double record_ms = percentile(measurement.record_times, 0.5);
+    if (threads == 1)
+      single_thread_ms = record_ms;
+
+    spdlog::info("{:>3} threads: record p50 {:.3f} ms, {:.2f}x, cpu frame "
+                 "p50 {:.3f} ms",
+                 threads, record_ms, single_thread_ms / record_ms,
+                 percentile(measurement.cpu_frame_times, 0.5));
+  }
+}
+
+// Frustum culls a grid three times the size of the viewport with every
+// kernel the CPU supports, on one thread and on every hardware thread, and
+// reports the throughput against the scalar kernel. Needs no device.
+void measure_culling(const BenchConfig &config) {
+  engine::CullStore store;
+  for (uint32_t i = 0; i < config.cull; i++)
+    store.add(grid_transform(i, config.cull, 3.0f),
+              {0.0f, 0.0f, 0.0f, std::sqrt(0.5f)});
+
+  engine::CullKernel best = engine::best_cull_kernel();
+  uint32_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+  double scalar_objects_per_ms = 0.0;
+
+  spdlog::info("{} frames culling {} objects", config.frames, config.cull);
+  for (auto kernel : {engine::CullKernel::SCALAR, engine::CullKernel::SSE,
+                      engine::CullKernel::AVX2}) {
+    if (kernel > best)
+      continue;
+
+    for (uint32_t threads = 1; threads <= max_threads;
+         threads = threads == max_threads ? threads + 1 : max_threads) {
+      engine::FrustumCuller culler;
+      culler.kernel = kernel;
+      culler.init(threads);
+
+      std::vector<double> cull_times;
+      cull_times.reserve(config.frames);
+      for (uint32_t i = 0; i < config.warmup_frames + config.frames; i++) {
+        culler.cull(store, glm::mat4(1.0f));
+        if (i >= config.warmup_frames)
+          cull_times.push_back(culler.stats.cull_ms);
+      }
+
+      double cull_ms = percentile(cull_times, 0.5);
+      double objects_per_ms = config.cull / cull_ms;
+      if (kernel == engine::CullKernel::SCALAR && threads == 1)
+        scalar_objects_per_ms = objects_per_ms;
+
+      spdlog::info("{:>6} on {:>3} threads: p50 {:.3f} ms, {:.0f} objects/ms, "
+                   "{:.2f}x scalar, {} visible",
+                   engine::cull_kernel_name(kernel), threads, cull_ms,
+                   objects_per_ms, objects_per_ms / scalar_objects_per_ms,
+                   culler.visible_count);
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  BenchConfig config;
+  config.parse(argc, argv);
+  if (config.cull > 0) {
+    measure_culling(config);
+    return 0;
+  }
+
+  using clock = std::chrono::steady_clock;
+  auto startup = clock::now();
+
+  engine::BootstrapInfo bootstrap;
+  bootstrap.headless = true;
+  bootstrap.pipeline_cache_path = config.pipeline_cache_path;
+  bootstrap.headless_extent = {config.width, config.height};
+  bootstrap.init();
+
+  engine::RenderData render_data;
+  render_data.MAX_FRAMES_IN_FLIGHT = config.frames_in_flight;
+  render_data.memory.dump_path = config.memory_dump_path;
+  render_data.scene_draw_count = config.draws;
+  render_data.gpu_driven = config.objects > 0;
+  render_data.occlusion_culling = config.occlusion > 0;
+  render_data.recording_threads = config.threads;
+  render_data.cpu_culling = config.cpu_cull > 0 && !render_data.gpu_driven;
+  render_data.culling_threads = 0;
+  render_data.sorting_threads = 0;
+  if (render_data.cpu_culling)
+    for (uint32_t i = 0; i < config.draws; i++)
+      render_data.scene_objects.add(grid_transform(i, config.draws, 3.0f),
+                                    {0.0f, 0.0f, 0.0f, std::sqrt(0.5f)});
+  render_data.instances.capacity =
+      std::max(render_data.instances.capacity, config.instances);
+  render_data.profiler.record_samples = true;
+  render_data.init(bootstrap);
+
+  engine::Library library;
+  library.init(bootstrap);
+  library.optimize_meshes = config.optimize > 0;
+  engine::Mesh mesh;
+  if (config.mesh_path) {
+    auto load_start = clock::now();
+    mesh = library.load_mesh(bootstrap, config.mesh_path);
+    spdlog::info("Loaded {} in {:.2f} ms", config.mesh_path,
+                 std::chrono::duration<double, std::milli>(clock::now() -
+                                                           load_start)
+                     .count());
+  } else {
+    mesh = library.add_mesh(
+        bootstrap,
+        std::vector(engine::VERTICES.cbegin(), engine::VERTICES.cend()),
+        std::vector(engine::INDICES.cbegin(), engine::INDICES.cend()));
+  }
+  CHECK_REPORT_STR(mesh.valid(), "No memory for the scene mesh");
+  if (render_data.gpu_driven) {
+    populate_gpu_scene(render_data.gpu_scene, mesh, config.objects,
+                       config.layers);
+    render_data.gpu_scene.commit(bootstrap, library.uploader);
+  }
+  library.flush_uploads(bootstrap);
+  engine::mesh = &mesh;
+
+  // Measured frames should draw the scene rather than a pipeline-less clear
+  render_data.pipelines.wait_idle();
+
+  Measurement measurement =
+      measure(bootstrap, render_data, library, config, startup);
+  auto &cpu_frame_times = measurement.cpu_frame_times;
+  auto &gpu_frame_times = measurement.gpu_frame_times;
+
+  if (render_data.gpu_driven)
+    spdlog::info("{} frames, {} GPU-driven objects, {}x{} on {}",
+                 config.frames, config.objects, config.width, config.height,
+                 bootstrap.physical_device.name);
+  else
+    spdlog::info("{} frames, {} draws/frame, {}x{} on {}", config.frames,
+                 config.draws, config.width, config.height,
+                 bootstrap.physical_device.name);
+  if (config.instances > 0)
+    spdlog::info("{} instances in {} draw calls", config.instances,
+                 render_data.instances.batches.size());
+  spdlog::info("startup to first frame: {:.1f} ms ({} pipeline cache)",
+               measurement.first_frame_ms,
+               bootstrap.pipeline_cache.warm ? "warm" : "cold");
+  spdlog::info("fps: {:.1f}", config.frames / measurement.total_s);
+  spdlog::info("cpu frame time: p50 {:.3f} ms, p99 {:.3f} ms",
+               percentile(cpu_frame_times, 0.5),
+               percentile(cpu_frame_times, 0.99));
+  if (gpu_frame_times.empty())
+    spdlog::warn("gpu frame time: timestamps are not supported");
+  else
+    spdlog::info("gpu frame time: p50 {:.3f} ms, p99 {:.3f} ms",
+                 percentile(gpu_frame_times, 0.5),
+                 percentile(gpu_frame_times, 0.99));
+  // Every render pass instance stores the color target, only the early one
+  // of occlusion culling stores the depth too. The resumed ones load both.
+  double color_mib =
+      target_mib(bootstrap, color_format_size(bootstrap.image_format()));
+  double depth_mib = target_mib(
+      bootstrap, depth_format_size(render_data.depth_pyramid.depth_format));
+  spdlog::info("render targets: {} pass instances, {:.1f} MiB loaded, {:.1f} "
+               "MiB stored per frame",
+               render_data.render_pass_instances,
+               render_data.resumed_render_passes * (color_mib + depth_mib),
+               render_data.render_pass_instances * color_mib +
+                   render_data.depth_storing_passes * depth_mib);
+  spdlog::info("scene recording on {} threads: p50 {:.3f} ms, p99 {:.3f} ms",
+               std::max(1u, render_data.recording_threads),
+               percentile(measurement.record_times, 0.5),
+               percentile(measurement.record_times, 0.99));
+  if (!render_data.gpu_driven)
+    spdlog::info("render queue sort on {} threads: p50 {:.3f} ms, p99 {:.3f} "
+                 "ms, {} binds, {} avoided",
+                 render_data.render_queue.stats.sort_threads,
+                 percentile(measurement.sort_times, 0.5),
+                 percentile(measurement.sort_times, 0.99), measurement.binds,
+                 measurement.binds_avoided);
+  if (render_data.gpu_driven) {
+    // Counts of the last frame read back, compare the scene time with and
+    // without --occlusion
+    auto &counts = render_data.gpu_scene.counts;
+    spdlog::info("{} culling over {} layers: {} drawn early, {} drawn late, "
+                 "{} occluded",
+                 render_data.occlusion_culling ? "occlusion" : "frustum",
+                 config.layers, counts.early_draws, counts.late_draws,
+                 counts.occluded);
+    if (!measurement.scene_gpu_times.empty())
+      spdlog::info("scene gpu time: p50 {:.3f} ms, p99 {:.3f} ms",
+                   percentile(measurement.scene_gpu_times, 0.5),
+                   percentile(measurement.scene_gpu_times, 0.99));
+  }
+  if (render_data.cpu_culling) {
+    double cull_ms = percentile(measurement.cull_times, 0.5);
+    spdlog::info("frustum culling ({}, {} threads): p50 {:.3f} ms, {:.0f} "
+                 "objects/ms, {} / {} visible",
+                 engine::cull_kernel_name(render_data.culler.kernel),
+                 render_data.culler.thread_count, cull_ms,
+                 config.draws / cull_ms, render_data.culler.stats.visible,
+                 config.draws);
+  }
+  if (config.stream > 0)
+    spdlog::info("streamed {} meshes/frame: {} arena pages, {} deferred "
+                 "destructions pending",
+                 config.stream, measurement.arena_pages,
+                 measurement.pending_deletions);
+  if (measurement.command_buffer_allocations > 0)
+    spdlog::warn("{} command buffers were allocated while measuring",
+                 measurement.command_buffer_allocations);
+
+  if (config.memory_dump_path) {
+    render_data.memory.update_statistics(bootstrap);
+    render_data.memory.dump(config.memory_dump_path);
+    spdlog::info("Memory telemetry written to {}", config.memory_dump_path);
+  }
+
+  if (config.profile_path) {
+    render_data.profiler.export_to_file(config.profile_path);
+    spdlog::info("GPU profile written to {}", config.profile_path);
+  }
+
+  if (config.scaling) {
+    CHECK_REPORT_STR(!render_data.gpu_driven,
+                     "The GPU-driven scene is recorded on a single thread");
+    measure_scaling(bootstrap, render_data, library, config);
+  }
+
+  bootstrap.shutdown();
+
+  return 0;
+}
@@ -0,0 +1,242 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "bootstrap.hpp"
+#include "upload.hpp"
+#include "vertex_layout.hpp"
+
+namespace b::engine {
+
+// Range of a mesh inside the geometry arena. The buffers are shared with
+// every other mesh placed in the same page.
+struct Mesh {
+  VkBuffer vert_buffer = VK_NULL_HANDLE;
+  VkBuffer index_buffer = VK_NULL_HANDLE;
+
+  uint32_t page = 0;
+  VmaVirtualAllocation vert_allocation = VK_NULL_HANDLE;
+  VmaVirtualAllocation index_allocation = VK_NULL_HANDLE;
+
+  int32_t vertex_offset = 0;
+  uint32_t vertex_count = 0;
+  // In elements of index_type
+  uint32_t first_index = 0;
+  uint32_t index_count = 0;
+  VkIndexType index_type = VK_INDEX_TYPE_UINT32;
+
+  // False for a mesh the memory budget policy refused
+  bool valid() const { return vert_buffer != VK_NULL_HANDLE; }
+};
+
+// Large vertex and index buffers that meshes are sub-allocated from, so a
+// single bind covers every mesh of a page. Placement is tracked with VMA
+// virtual blocks sized in elements rather than bytes, which keeps vertex
+// offsets a multiple of the stride. Index ranges are placed in 32-bit units,
+// 16-bit index ranges take half as many. Pages other than the first are
+// released once their last mesh is freed, and their slots are reused.
+struct GeometryArena {
+  struct Page {
+    VkBuffer vert_buffer;
+    VmaAllocation vert_memory;
+    VmaVirtualBlock vert_block;
+    VkDeviceSize vertex_capacity;
+
+    VkBuffer index_buffer;
+    VmaAllocation index_memory;
+    VmaVirtualBlock index_block;
+    VkDeviceSize index_capacity;
+  };
+
+  std::vector<Page> pages;
+
+  VkDeviceSize vertex_stride = 0;
+  VkDeviceSize index_size = sizeof(uint32_t);
+  VkDeviceSize page_vertex_capacity = 1 << 20;
+  VkDeviceSize page_index_capacity = 3 << 20;
+
+  void init(VkDeviceSize stride) { vertex_stride = stride; }
+
+  static bool is_released(const Page &page) {
+    return page.vert_buffer == VK_NULL_HANDLE;
+  }
+
+  // Index capacity in 32-bit units taken by `index_count` indices
+  VkDeviceSize index_units(uint32_t index_count, VkIndexType index_type) const {
+    return (index_count * index_type_size(index_type) + index_size - 1) /
+           index_size;
+  }
+
+  // Capacities of a page that fits the mesh, only just when `exact`
+  void page_capacity(uint32_t vertex_count, uint32_t index_count,
+                     VkIndexType index_type, bool exact,
+                     VkDeviceSize &vertex_capacity,
+                     VkDeviceSize &index_capacity) const {
+    vertex_capacity = vertex_count;
+    index_capacity = index_units(index_count, index_type);
+    if (!exact) {
+      vertex_capacity = std::max(page_vertex_capacity, vertex_capacity);
+      index_capacity = std::max(page_index_capacity, index_capacity);
+    }
+  }
+
+  // Memory a new page for the mesh would take
+  VkDeviceSize page_bytes(uint32_t vertex_count, uint32_t index_count,
+                          VkIndexType index_type, bool exact) const {
+    VkDeviceSize vertex_capacity, index_capacity;
+    page_capacity(vertex_count, index_count, index_type, exact,
+                  vertex_capacity, index_capacity);
+    return vertex_capacity * vertex_stride + index_capacity * index_size;
+  }
+
+  // Returns the index of the page
+  uint32_t add_page(BootstrapInfo &bootstrap, Uploader &uploader,
+                    VkDeviceSize vertex_capacity,
+                    VkDeviceSize index_capacity) {
+    Page page = {};
+    page.vertex_capacity = vertex_capacity;
+    page.index_capacity = index_capacity;
+
+    uploader.create_device_buffer(
+        bootstrap, page.vertex_capacity * vertex_stride,
+        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, &page.vert_buffer,
+        &page.vert_memory);
+    uploader.create_device_buffer(
+        bootstrap, page.index_capacity * index_size,
+        VK_BUFFER_USAGE_INDEX_BUFFER_BIT, &page.index_buffer,
+        &page.index_memory);
+
+    VmaVirtualBlockCreateInfo block_info = {};
+    block_info.size = page.vertex_capacity;
+    CHECK_VK(vmaCreateVirtualBlock(&block_info, &page.vert_block));
+    block_info.size = page.index_capacity;
+    CHECK_VK(vmaCreateVirtualBlock(&block_info, &page.index_block));
+
+    uint32_t index = std::find_if(pages.begin(), pages.end(), is_released) -
+                     pages.begin();
+    if (index == pages.size())
+      pages.push_back(page);
+    else
+      pages[index] = page;
+
+    spdlog::info("Geometry arena page {}: {} vertices, {} indices", index,
+                 page.vertex_capacity, page.index_capacity);
+    return index;
+  }
+
+  void release_page(BootstrapInfo &bootstrap, uint32_t index) {
+    Page &page = pages[index];
+    vmaDestroyVirtualBlock(page.vert_block);
+    vmaDestroyVirtualBlock(page.index_block);
+    vmaDestroyBuffer(bootstrap.allocator, page.vert_buffer, page.vert_memory);
+    vmaDestroyBuffer(bootstrap.allocator, page.index_buffer,
+                     page.index_memory);
+    page = {};
+
+    spdlog::info("Released geometry arena page {}", index);
+  }
+
+  static bool allocate_range(VmaVirtualBlock block, VkDeviceSize count,
+                             VmaVirtualAllocation *allocation,
+                             VkDeviceSize *offset) {
+    VmaVirtualAllocationCreateInfo allocation_info = {};
+    allocation_info.size = count;
+    allocation_info.alignment = 1;
+    return vmaVirtualAllocate(block, &allocation_info, allocation, offset) ==
+           VK_SUCCESS;
+  }
+
+  bool try_place(uint32_t page_index, uint32_t vertex_count,
+                 uint32_t index_count, VkIndexType index_type, Mesh &mesh) {
+    Page &page = pages[page_index];
+
+    VkDeviceSize vertex_offset = 0;
+    if (!allocate_range(page.vert_block, vertex_count, &mesh.vert_allocation,
+                        &vertex_offset))
+      return false;
+
+    VkDeviceSize first_unit = 0;
+    if (!allocate_range(page.index_block, index_units(index_count, index_type),
+                        &mesh.index_allocation, &first_unit)) {
+      vmaVirtualFree(page.vert_block, mesh.vert_allocation);
+      return false;
+    }
+
+    mesh.page = page_index;
+    mesh.vert_buffer = page.vert_buffer;
+    mesh.index_buffer = page.index_buffer;
+    mesh.vertex_offset = vertex_offset;
+    mesh.vertex_count = vertex_count;
+    mesh.first_index = first_unit * index_size / index_type_size(index_type);
+    mesh.index_count = index_count;
+    mesh.index_type = index_type;
+    return true;
+  }
+
+  // Places the mesh in one of the existing pages, returns false if none has
+  // room for it
+  bool try_allocate(uint32_t vertex_count, uint32_t index_count,
+                    VkIndexType index_type, Mesh &mesh) {
+    for (uint32_t i = 0; i < pages.size(); i++)
+      if (!is_released(pages[i]) &&
+          try_place(i, vertex_count, index_count, index_type, mesh))
+        return true;
+    return false;
+  }
+
+  Mesh allocate_in_new_page(BootstrapInfo &bootstrap, Uploader &uploader,
+                            uint32_t vertex_count, uint32_t index_count,
+                            VkIndexType index_type, bool exact = false) {
+    VkDeviceSize vertex_capacity, index_capacity;
+    page_capacity(vertex_count, index_count, index_type, exact,
+                  vertex_capacity, index_capacity);
+
+    Mesh mesh = {};
+    uint32_t page =
+        add_page(bootstrap, uploader, vertex_capacity, index_capacity);
+    CHECK(try_place(page, vertex_count, index_count, index_type, mesh));
+    return mesh;
+  }
+
+  // Reserves a range for the mesh, the contents are left to the caller
+  Mesh allocate(BootstrapInfo &bootstrap, Uploader &uploader,
+                uint32_t vertex_count, uint32_t index_count,
+                VkIndexType index_type = VK_INDEX_TYPE_UINT32) {
+    Mesh mesh = {};
+    if (try_allocate(vertex_count, index_count, index_type, mesh))
+      return mesh;
+    return allocate_in_new_page(bootstrap, uploader, vertex_count, index_count,
+                                index_type);
+  }
+
+  // The range is reused right away, the GPU must be done with it
+  void free(BootstrapInfo &bootstrap, const Mesh &mesh) {
+    Page &page = pages[mesh.page];
+    vmaVirtualFree(page.vert_block, mesh.vert_allocation);
+    vmaVirtualFree(page.index_block, mesh.index_allocation);
+
+    if (mesh.page != 0 && vmaIsVirtualBlockEmpty(page.vert_block))
+      release_page(bootstrap, mesh.page);
+  }
+
+  void upload(BootstrapInfo &bootstrap, Uploader &uploader, const Mesh &mesh,
+              const void *vertices, const void *indices) {
+    Page &page = pages[mesh.page];
+    uploader.upload(bootstrap, page.vert_buffer, page.vert_memory,
+                    mesh.vertex_offset * vertex_stride, vertices,
+                    mesh.vertex_count * vertex_stride,
+                    VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,
+                    VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
+    VkDeviceSize mesh_index_size = index_type_size(mesh.index_type);
+    uploader.upload(bootstrap, page.index_buffer, page.index_memory,
+                    mesh.first_index * mesh_index_size, indices,
+                    mesh.index_count * mesh_index_size,
+                    VK_ACCESS_INDEX_READ_BIT,
+                    VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
+  }
+};
+
+} // namespace b::engine
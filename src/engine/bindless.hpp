@@ -0,0 +1,347 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <vulkan/vulkan.h>
+
+#include "bootstrap.hpp"
+#include "upload.hpp"
+
+namespace b::engine {
+
+// Matches `Material` in shader.frag
+struct GpuMaterial {
+  // Multiplied with the vertex color and the texture
+  glm::vec4 base_color = glm::vec4(1.0f);
+  // Bindless texture index, 0 is plain white
+  uint32_t texture = 0;
+  uint32_t padding[3] = {};
+};
+
+struct Texture {
+  VkImage image = VK_NULL_HANDLE;
+  VmaAllocation allocation = VK_NULL_HANDLE;
+  VkImageView view = VK_NULL_HANDLE;
+  // Completes once every mip level can be sampled
+  SubmitTicket ticket;
+  // The descriptor is written, materials may sample it
+  bool resident = false;
+};
+
+// Every texture and material in a single descriptor set, so draws pick them
+// by index instead of binding anything and can be merged into indirect
+// draws whatever they sample. The textures are an update-after-bind,
+// partially bound array of sampled images next to one immutable sampler,
+// and the materials a storage buffer indexed by the material ID.
+//
+// Textures upload in the background, a slot's descriptor is only written
+// once its upload completed. Until then the materials using it sample the
+// white texture, so nothing waits and no in-flight frame sees a slot change.
+// Materials are copied into a host visible buffer per frame in flight
+// whenever they change.
+struct BindlessResources {
+  struct Frame {
+    VkBuffer material_buffer = VK_NULL_HANDLE;
+    VmaAllocation material_allocation = VK_NULL_HANDLE;
+    GpuMaterial *materials = nullptr;
+    VkDescriptorSet descriptor_set = VK_NULL_HANDLE;
+    // Generation of the materials copied into the buffer
+    uint64_t generation = 0;
+  };
+
+  static constexpr uint32_t MAX_MATERIALS = 4096;
+  // Clamped to the update-after-bind limits of the device by init
+  uint32_t max_textures = 4096;
+
+  // Textures have their own staging so they do not hold up mesh uploads,
+  // the largest texture has to fit
+  VkDeviceSize staging_size = 32 << 20;
+  Uploader uploader;
+
+  VkSampler sampler;
+  VkDescriptorSetLayout set_layout;
+  VkDescriptorPool descriptor_pool;
+
+  std::vector<Frame> frames;
+  uint32_t current = 0;
+
+  std::vector<Texture> textures;
+  // Textures whose upload was still running at the last check
+  std::vector<uint32_t> uploading;
+  std::vector<GpuMaterial> materials;
+  // Bumped whenever the materials as the GPU sees them change
+  uint64_t generation = 1;
+
+  void init_layout(BootstrapInfo &bootstrap) {
+    VkPhysicalDeviceDescriptorIndexingProperties indexing_properties = {};
+    indexing_properties.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES;
+    VkPhysicalDeviceProperties2 properties = {};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    properties.pNext = &indexing_properties;
+    bootstrap.instance_dispatch.getPhysicalDeviceProperties2(
+        bootstrap.physical_device, &properties);
+    max_textures = std::min(
+        {max_textures,
+         indexing_properties.maxPerStageDescriptorUpdateAfterBindSampledImages,
+         indexing_properties.maxDescriptorSetUpdateAfterBindSampledImages});
+
+    VkSamplerCreateInfo sampler_info = {};
+    sampler_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    sampler_info.magFilter = VK_FILTER_LINEAR;
+    sampler_info.minFilter = VK_FILTER_LINEAR;
+    sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    sampler_info.maxLod = VK_LOD_CLAMP_NONE;
+    CHECK_VK(bootstrap.dispatch.createSampler(&sampler_info, NULL, &sampler));
+
+    std::array<VkDescriptorSetLayoutBinding, 3> bindings = {};
+    bindings[0].binding = 0;
+    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+    bindings[0].descriptorCount = 1;
+    bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    bindings[0].pImmutableSamplers = &sampler;
+    bindings[1].binding = 1;
+    bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+    bindings[1].descriptorCount = max_textures;
+    bindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    bindings[2].binding = 2;
+    bindings[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[2].descriptorCount = 1;
+    bindings[2].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    std::array<VkDescriptorBindingFlags, 3> binding_flags = {
+        0,
+        VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT |
+            VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+            VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT,
+        0,
+    };
+    VkDescriptorSetLayoutBindingFlagsCreateInfo flags_info = {};
+    flags_info.sType =
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+    flags_info.bindingCount = binding_flags.size();
+    flags_info.pBindingFlags = binding_flags.data();
+
+    VkDescriptorSetLayoutCreateInfo layout_info = {};
+    layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layout_info.pNext = &flags_info;
+    layout_info.flags =
+        VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+    layout_info.bindingCount = bindings.size();
+    layout_info.pBindings = bindings.data();
+    CHECK_VK(bootstrap.dispatch.createDescriptorSetLayout(&layout_info, NULL,
+                                                          &set_layout));
+  }
+
+  void init_frames(BootstrapInfo &bootstrap, uint32_t frames_in_flight) {
+    frames.resize(frames_in_flight);
+
+    std::array<VkDescriptorPoolSize, 3> pool_sizes = {
+        VkDescriptorPoolSize{VK_DESCRIPTOR_TYPE_SAMPLER, frames_in_flight},
+        VkDescriptorPoolSize{VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+                             max_textures * frames_in_flight},
+        VkDescriptorPoolSize{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                             frames_in_flight},
+    };
+    VkDescriptorPoolCreateInfo pool_info = {};
+    pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    pool_info.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+    pool_info.maxSets = frames_in_flight;
+    pool_info.poolSizeCount = pool_sizes.size();
+    pool_info.pPoolSizes = pool_sizes.data();
+    CHECK_VK(bootstrap.dispatch.createDescriptorPool(&pool_info, NULL,
+                                                     &descriptor_pool));
+
+    VkBufferCreateInfo buffer_info = {};
+    buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_info.size = sizeof(GpuMaterial) * MAX_MATERIALS;
+    buffer_info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    VmaAllocationCreateInfo vmalloc_info = {};
+    vmalloc_info.usage = VMA_MEMORY_USAGE_AUTO;
+    vmalloc_info.flags =
+        VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
+        VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+    for (auto &frame : frames) {
+      VmaAllocationInfo allocation_info = {};
+      CHECK_VK(vmaCreateBuffer(bootstrap.allocator, &buffer_info,
+                               &vmalloc_info, &frame.material_buffer,
+                               &frame.material_allocation, &allocation_info));
+      frame.materials = (GpuMaterial *)allocation_info.pMappedData;
+      CHECK(frame.materials);
+
+      VkDescriptorSetAllocateInfo set_info = {};
+      set_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+      set_info.descriptorPool = descriptor_pool;
+      set_info.descriptorSetCount = 1;
+      set_info.pSetLayouts = &set_layout;
+      CHECK_VK(bootstrap.dispatch.allocateDescriptorSets(
+          &set_info, &frame.descriptor_set));
+
+      VkDescriptorBufferInfo material_info = {frame.material_buffer, 0,
+                                              VK_WHOLE_SIZE};
+      VkWriteDescriptorSet write = {};
+      write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      write.dstSet = frame.descriptor_set;
+      write.dstBinding = 2;
+      write.descriptorCount = 1;
+      write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      write.pBufferInfo = &material_info;
+      bootstrap.dispatch.updateDescriptorSets(1, &write, 0, nullptr);
+    }
+  }
+
+  // Texture 0 is white and material 0 uses it, both are ready on return
+  void init(BootstrapInfo &bootstrap, uint32_t frames_in_flight) {
+    uploader.init(bootstrap, staging_size);
+    init_layout(bootstrap);
+    init_frames(bootstrap, frames_in_flight);
+
+    uint32_t white = 0xffffffff;
+    add_texture(bootstrap, &white, 1, 1);
+    bootstrap.wait(textures[0].ticket);
+    make_resident(bootstrap, 0);
+    uploading.clear();
+
+    add_material({});
+  }
+
+  // Uploads RGBA8 pixels and generates the mip chain on the GPU. Returns the
+  // index materials refer to it by, usable right away.
+  uint32_t add_texture(BootstrapInfo &bootstrap, const void *pixels,
+                       uint32_t width, uint32_t height) {
+    CHECK_REPORT_FMT(textures.size() < max_textures,
+                     "At most {} textures can be bound", max_textures);
+
+    uint32_t mip_levels = std::floor(std::log2(std::max(width, height))) + 1;
+
+    VkImageCreateInfo image_info = {};
+    image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    image_info.imageType = VK_IMAGE_TYPE_2D;
+    image_info.format = VK_FORMAT_R8G8B8A8_UNORM;
+    image_info.extent = {width, height, 1};
+    image_info.mipLevels = mip_levels;
+    image_info.arrayLayers = 1;
+    image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+    image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    image_info.usage = VK_IMAGE_USAGE_SAMPLED_BIT |
+                       VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+                       VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    VmaAllocationCreateInfo vmalloc_info = {};
+    vmalloc_info.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+
+    Texture texture;
+    CHECK_VK(vmaCreateImage(bootstrap.allocator, &image_info, &vmalloc_info,
+                            &texture.image, &texture.allocation, nullptr));
+
+    VkImageViewCreateInfo view_info = {};
+    view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    view_info.image = texture.image;
+    view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    view_info.format = image_info.format;
+    view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    view_info.subresourceRange.levelCount = mip_levels;
+    view_info.subresourceRange.layerCount = 1;
+    CHECK_VK(
+        bootstrap.dispatch.createImageView(&view_info, NULL, &texture.view));
+
+    // Submitted right away and never waited for
+    uploader.upload_image(bootstrap, texture.image, {width, height},
+                          mip_levels, pixels);
+    texture.ticket = uploader.flush(bootstrap);
+
+    textures.push_back(texture);
+    uploading.push_back(textures.size() - 1);
+    return textures.size() - 1;
+  }
+
+  uint32_t add_material(const GpuMaterial &material) {
+    CHECK_REPORT_FMT(materials.size() < MAX_MATERIALS,
+                     "At most {} materials are supported", MAX_MATERIALS);
+    materials.push_back({});
+    set_material(materials.size() - 1, material);
+    return materials.size() - 1;
+  }
+
+  // Seen by the frames built from the next begin_frame on
+  void set_material(uint32_t index, const GpuMaterial &material) {
+    CHECK_REPORT_FMT(material.texture < textures.size(),
+                     "Material {} refers to the unknown texture {}", index,
+                     material.texture);
+    materials[index] = material;
+    generation++;
+  }
+
+  // Writes the descriptor of every frame's set. No material resolves to the
+  // slot yet, so the frames in flight do not use it.
+  void make_resident(BootstrapInfo &bootstrap, uint32_t index) {
+    VkDescriptorImageInfo image_info = {};
+    image_info.imageView = textures[index].view;
+    image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+    for (auto &frame : frames) {
+      VkWriteDescriptorSet write = {};
+      write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      write.dstSet = frame.descriptor_set;
+      write.dstBinding = 1;
+      write.dstArrayElement = index;
+      write.descriptorCount = 1;
+      write.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+      write.pImageInfo = &image_info;
+      bootstrap.dispatch.updateDescriptorSets(1, &write, 0, nullptr);
+    }
+    textures[index].resident = true;
+    generation++;
+  }
+
+  // The fence of the frame must have been waited on. Picks up the textures
+  // that finished uploading and refreshes the frame's materials.
+  void begin_frame(BootstrapInfo &bootstrap, uint32_t frame_index) {
+    current = frame_index;
+
+    auto still_uploading = std::remove_if(
+        uploading.begin(), uploading.end(), [&](uint32_t index) {
+          if (!bootstrap.is_complete(textures[index].ticket))
+            return false;
+          make_resident(bootstrap, index);
+          return true;
+        });
+    uploading.erase(still_uploading, uploading.end());
+
+    Frame &frame = frames[current];
+    if (frame.generation == generation)
+      return;
+
+    for (size_t i = 0; i < materials.size(); i++) {
+      GpuMaterial material = materials[i];
+      if (!textures[material.texture].resident)
+        material.texture = 0;
+      frame.materials[i] = material;
+    }
+    CHECK_VK(vmaFlushAllocation(bootstrap.allocator, frame.material_allocation,
+                                0, sizeof(GpuMaterial) * materials.size()));
+    frame.generation = generation;
+  }
+
+  void cmd_bind(BootstrapInfo &bootstrap, VkCommandBuffer command_buffer,
+                VkPipelineBindPoint bind_point, VkPipelineLayout layout,
+                uint32_t set) {
+    bootstrap.dispatch.cmdBindDescriptorSets(
+        command_buffer, bind_point, layout, set, 1,
+        &frames[current].descriptor_set, 0, nullptr);
+  }
+};
+
+} // namespace b::engine
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstdlib>
+
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 #include <VkBootstrap.h>
@@ -8,6 +10,10 @@
 #define VMA_IMPLEMENTATION
 #include <vk_mem_alloc.h>
 
+#include "deletion_queue.hpp"
+#include "frame_pacing.hpp"
+#include "pipeline_cache.hpp"
+#include "submission.hpp"
 #include "utils/utils.hpp"
 
 namespace b {
@@ -38,16 +44,43 @@ int GLFW_check_error() {
 }
 
 struct BootstrapInfo {
-  GLFWwindow *window;
+  // Headless mode renders into offscreen images instead of a swapchain and
+  // accepts software devices (e.g. lavapipe), useful for CI and benchmarks.
+  bool headless = false;
+  VkExtent2D headless_extent = {1024, 1024};
+  uint32_t headless_image_count = 2;
+  VkFormat headless_format = VK_FORMAT_R8G8B8A8_UNORM;
+
+  GLFWwindow *window = nullptr;
   vkb::Instance instance;
   vkb::InstanceDispatchTable instance_dispatch;
-  VkSurfaceKHR surface;
+  VkSurfaceKHR surface = VK_NULL_HANDLE;
   vkb::PhysicalDevice physical_device;
   vkb::Device device;
   vkb::DispatchTable dispatch;
   vkb::Swapchain swapchain;
   VmaAllocator allocator;
-  VkCommandPool immediate_command_pool;
+
+  // Falls back to the graphics queue when the device has no separate one
+  VkQueue transfer_queue = VK_NULL_HANDLE;
+  uint32_t transfer_queue_family = 0;
+
+  QueueSubmitter graphics_submitter;
+  QueueSubmitter transfer_submitter;
+
+  // Preferred present mode, see present_mode_fallbacks for what is used when
+  // the surface does not support it. Applied by the next swapchain build.
+  VkPresentModeKHR present_mode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+
+  // Resources released while frames are in flight, collected by the
+  // renderer at the start of every frame
+  DeletionQueue deletion_queue;
+
+  const char *pipeline_cache_path = "./build/pipeline_cache.bin";
+  // Directory of <name>.spv files used instead of the embedded shaders,
+  // e.g. glslc output while iterating on a shader
+  const char *shader_override_dir = std::getenv("SBOX_SHADER_DIR");
+  PipelineCache pipeline_cache;
 
   VkSurfaceKHR create_surface() {
     CHECK_REPORT_STR(
@@ -66,11 +99,25 @@ struct BootstrapInfo {
     return surface;
   }
 
+  VkExtent2D extent() const {
+    return headless ? headless_extent : swapchain.extent;
+  }
+
+  VkFormat image_format() const {
+    return headless ? headless_format : swapchain.image_format;
+  }
+
+  uint32_t image_count() const {
+    return headless ? headless_image_count : swapchain.image_count;
+  }
+
   void init_device() {
-    window = GLFWwindow_create("VkSandbox");
+    if (!headless)
+      window = GLFWwindow_create("VkSandbox");
 
     vkb::InstanceBuilder instance_builder;
-    instance_builder.request_validation_layers()
+    instance_builder.set_headless(headless)
+        .request_validation_layers()
         .set_app_name("Sandbox")
         .set_engine_name("Sandbox Vulkan Engine")
         .require_api_version(1, 2, 0)
@@ -99,13 +146,37 @@ struct BootstrapInfo {
 
     instance = instance_ret.value();
     instance_dispatch = instance.make_table();
-    surface = create_surface();
 
     vkb::PhysicalDeviceSelector physical_device_selector(instance);
-    auto physical_device_ret = physical_device_selector.set_surface(surface)
-                                   .prefer_gpu_device_type()
-                                   .allow_any_gpu_device_type(false)
-                                   .select();
+    physical_device_selector.prefer_gpu_device_type();
+    if (headless) {
+      // Software implementations report themselves as CPU devices
+      physical_device_selector.require_present(false).allow_any_gpu_device_type(
+          true);
+    } else {
+      surface = create_surface();
+      physical_device_selector.set_surface(surface).allow_any_gpu_device_type(
+          false);
+    }
+
+    VkPhysicalDeviceFeatures features = {};
+    features.multiDrawIndirect = VK_TRUE;
+    features.drawIndirectFirstInstance = VK_TRUE;
+    physical_device_selector.set_required_features(features);
+
+    VkPhysicalDeviceVulkan12Features features_12 = {};
+    features_12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    features_12.timelineSemaphore = VK_TRUE;
+    features_12.drawIndirectCount = VK_TRUE;
+    // Bindless textures, see bindless.hpp
+    features_12.runtimeDescriptorArray = VK_TRUE;
+    features_12.descriptorBindingPartiallyBound = VK_TRUE;
+    features_12.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+    features_12.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+    features_12.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+    physical_device_selector.set_required_features_12(features_12);
+
+    auto physical_device_ret = physical_device_selector.select();
     CHECK(physical_device_ret);
     physical_device = physical_device_ret.value();
     spdlog::info("Using {}", physical_device.name);
@@ -118,18 +189,31 @@ struct BootstrapInfo {
     dispatch = device.make_table();
   }
 
-  void init_swapchain() {
+  // Builds a swapchain for the current window size, passing the current one
+  // as oldSwapchain. The old swapchain is returned and has to outlive the
+  // frames still using its images.
+  vkb::Swapchain replace_swapchain() {
     vkb::SwapchainBuilder swapchain_builder(device);
-    // TODO: select at runtime/compile time
-    auto swapchain_ret =
-        swapchain_builder.set_old_swapchain(swapchain)
-            .set_desired_present_mode(VK_PRESENT_MODE_IMMEDIATE_KHR)
-            .build();
+    swapchain_builder.set_old_swapchain(swapchain);
+    auto present_modes = present_mode_fallbacks(present_mode);
+    swapchain_builder.set_desired_present_mode(present_modes[0]);
+    for (size_t i = 1; i < present_modes.size(); i++)
+      swapchain_builder.add_fallback_present_mode(present_modes[i]);
+
+    auto swapchain_ret = swapchain_builder.build();
     CHECK(swapchain_ret);
-    vkb::destroy_swapchain(swapchain);
+    vkb::Swapchain old_swapchain = swapchain;
     swapchain = swapchain_ret.value();
+
+    if (old_swapchain.swapchain == VK_NULL_HANDLE ||
+        swapchain.present_mode != old_swapchain.present_mode)
+      spdlog::info("Presenting in {} mode",
+                   present_mode_name(swapchain.present_mode));
+    return old_swapchain;
   }
 
+  void init_swapchain() { vkb::destroy_swapchain(replace_swapchain()); }
+
   void init_memory() {
     VmaAllocatorCreateInfo allocator_info = {};
     allocator_info.flags = VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
@@ -141,62 +225,107 @@ struct BootstrapInfo {
     CHECK_VK(vmaCreateAllocator(&allocator_info, &allocator));
   }
 
-  void init_immediate_command_pool() {
+  uint32_t graphics_queue_family() const {
+    return device.get_queue_index(vkb::QueueType::graphics).value();
+  }
+
+  void init_transfer_queue() {
+    // Prefer a transfer-only queue, then any queue without graphics
+    auto dedicated_ret = device.get_dedicated_queue(vkb::QueueType::transfer);
+    auto separate_ret = device.get_queue(vkb::QueueType::transfer);
+    if (dedicated_ret) {
+      transfer_queue = dedicated_ret.value();
+      transfer_queue_family =
+          device.get_dedicated_queue_index(vkb::QueueType::transfer).value();
+    } else if (separate_ret) {
+      transfer_queue = separate_ret.value();
+      transfer_queue_family =
+          device.get_queue_index(vkb::QueueType::transfer).value();
+    } else {
+      spdlog::info("No separate transfer queue, using the graphics queue");
+      transfer_queue = device.get_queue(vkb::QueueType::graphics).value();
+      transfer_queue_family = graphics_queue_family();
+    }
+  }
+
+  void init_submitters() {
     CHECK(device);
 
-    auto present_queue_ret = device.get_queue_index(vkb::QueueType::graphics);
-    CHECK(present_queue_ret);
+    auto graphics_queue_ret = device.get_queue(vkb::QueueType::graphics);
+    CHECK(graphics_queue_ret);
 
-    VkCommandPoolCreateInfo pool_info = {};
-    pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-    pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
-    pool_info.queueFamilyIndex = present_queue_ret.value();
+    graphics_submitter.init(dispatch, graphics_queue_ret.value(),
+                            graphics_queue_family());
+    transfer_submitter.init(dispatch, transfer_queue, transfer_queue_family);
+  }
 
-    CHECK_VK(
-        dispatch.createCommandPool(&pool_info, NULL, &immediate_command_pool));
+  QueueSubmitter &submitter(vkb::QueueType queue_type) {
+    return queue_type == vkb::QueueType::transfer ? transfer_submitter
+                                                  : graphics_submitter;
   }
 
+  // Records into the queue's pending batch without submitting it
   template <typename F>
-  void submit_immediate_command_buffer(vkb::QueueType queue_type, F record) {
-    VkCommandBufferAllocateInfo command_buffer_alloc_info = {};
-    command_buffer_alloc_info.sType =
-        VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    command_buffer_alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    command_buffer_alloc_info.commandPool = immediate_command_pool;
-    command_buffer_alloc_info.commandBufferCount = 1;
-
-    VkCommandBuffer command_buffer;
-    CHECK_VK(dispatch.allocateCommandBuffers(&command_buffer_alloc_info,
-                                             &command_buffer));
+  SubmitTicket record_async(vkb::QueueType queue_type, F record) {
+    return submitter(queue_type).record(dispatch, record);
+  }
 
-    VkCommandBufferBeginInfo begin_info = {};
-    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  // Submits everything recorded for the queue in a single vkQueueSubmit
+  SubmitTicket submit_async(vkb::QueueType queue_type) {
+    return submitter(queue_type).submit(dispatch);
+  }
 
-    CHECK_VK(dispatch.beginCommandBuffer(command_buffer, &begin_info));
+  bool is_complete(SubmitTicket ticket) {
+    if (!ticket.valid())
+      return true;
+    return ticket.timeline == transfer_submitter.timeline
+               ? transfer_submitter.is_complete(dispatch, ticket)
+               : graphics_submitter.is_complete(dispatch, ticket);
+  }
 
-    CHECK_VK(record(command_buffer));
+  void wait(SubmitTicket ticket) {
+    if (!ticket.valid())
+      return;
+    if (ticket.timeline == transfer_submitter.timeline)
+      transfer_submitter.wait(dispatch, ticket);
+    else
+      graphics_submitter.wait(dispatch, ticket);
+  }
 
-    CHECK_VK(dispatch.endCommandBuffer(command_buffer));
+  // Blocks until the recorded commands, and everything batched before them
+  // on the same queue, complete
+  template <typename F>
+  void submit_immediate_command_buffer(vkb::QueueType queue_type, F record) {
+    record_async(queue_type, record);
+    wait(submit_async(queue_type));
+  }
 
-    VkSubmitInfo submit_info{};
-    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submit_info.commandBufferCount = 1;
-    submit_info.pCommandBuffers = &command_buffer;
+  void init_pipeline_cache() {
+    pipeline_cache.init(dispatch, physical_device.properties,
+                        pipeline_cache_path);
+  }
 
-    auto queue_ret = device.get_queue(queue_type);
-    // TODO: error check this
-    auto queue = queue_ret.value();
+  // Runs the deferred destructions of the frames below `completed_frames`
+  void collect_garbage(uint64_t completed_frames) {
+    deletion_queue.collect(completed_frames, [&](SubmitTicket ticket) {
+      return is_complete(ticket);
+    });
+  }
 
-    vkQueueSubmit(queue, 1, &submit_info, VK_NULL_HANDLE);
-    vkQueueWaitIdle(queue);
+  void shutdown() {
+    dispatch.deviceWaitIdle();
+    deletion_queue.flush();
+    pipeline_cache.save(dispatch);
   }
 
   void init() {
     init_device();
-    init_swapchain();
+    if (!headless)
+      init_swapchain();
     init_memory();
-    init_immediate_command_pool();
+    init_transfer_queue();
+    init_submitters();
+    init_pipeline_cache();
   }
 };
 
@@ -0,0 +1,392 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <imgui/imgui.h>
+
+#include "utils/utils.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define B_CULL_X86 1
+#include <immintrin.h>
+#else
+#define B_CULL_X86 0
+#endif
+
+namespace b::engine {
+
+using FrustumPlanes = std::array<glm::vec4, 6>;
+
+// Normalized planes facing inwards, extracted from the clip space of a
+// Vulkan view-projection matrix
+inline FrustumPlanes frustum_planes(const glm::mat4 &view_projection) {
+  glm::mat4 m = glm::transpose(view_projection);
+  FrustumPlanes planes = {
+      m[3] + m[0], m[3] - m[0], m[3] + m[1], m[3] - m[1], m[2], m[3] - m[2],
+  };
+
+  for (auto &plane : planes)
+    plane /= glm::length(glm::vec3(plane));
+  return planes;
+}
+
+// Objects to cull, every array is indexed by object. The world space
+// bounding spheres are kept a component per array so the kernels load them
+// a register at a time, and are refreshed whenever a transform is set.
+struct CullStore {
+  std::vector<float> center_x;
+  std::vector<float> center_y;
+  std::vector<float> center_z;
+  std::vector<float> radius;
+  std::vector<glm::mat4> transforms;
+  // Object space bounding spheres, w is the radius
+  std::vector<glm::vec4> bounds;
+
+  uint32_t size() const { return transforms.size(); }
+
+  void clear() {
+    center_x.clear();
+    center_y.clear();
+    center_z.clear();
+    radius.clear();
+    transforms.clear();
+    bounds.clear();
+  }
+
+  uint32_t add(const glm::mat4 &transform, const glm::vec4 &object_bounds) {
+    center_x.push_back(0.0f);
+    center_y.push_back(0.0f);
+    center_z.push_back(0.0f);
+    radius.push_back(0.0f);
+    transforms.push_back(transform);
+    bounds.push_back(object_bounds);
+    set_transform(size() - 1, transform);
+    return size() - 1;
+  }
+
+  // The radius grows with the largest scale of the transform
+  void set_transform(uint32_t object, const glm::mat4 &transform) {
+    transforms[object] = transform;
+    glm::vec4 center = transform * glm::vec4(glm::vec3(bounds[object]), 1.0f);
+    float scale_2 = std::max({glm::dot(transform[0], transform[0]),
+                              glm::dot(transform[1], transform[1]),
+                              glm::dot(transform[2], transform[2])});
+
+    center_x[object] = center.x;
+    center_y[object] = center.y;
+    center_z[object] = center.z;
+    radius[object] = bounds[object].w * std::sqrt(scale_2);
+  }
+};
+
+enum class CullKernel {
+  SCALAR,
+  SSE,
+  AVX2,
+};
+
+inline const char *cull_kernel_name(CullKernel kernel) {
+  switch (kernel) {
+  case CullKernel::SSE:
+    return "sse";
+  case CullKernel::AVX2:
+    return "avx2";
+  default:
+    return "scalar";
+  }
+}
+
+// The widest kernel the running CPU supports
+inline CullKernel best_cull_kernel() {
+#if B_CULL_X86
+  if (__builtin_cpu_supports("avx2"))
+    return CullKernel::AVX2;
+  if (__builtin_cpu_supports("sse2"))
+    return CullKernel::SSE;
+#endif
+  return CullKernel::SCALAR;
+}
+
+// The kernels write the indices of the objects in [begin, end) that
+// intersect the frustum to `out` and return how many there are. `out` must
+// have room for end - begin indices, the SIMD kernels write every lane and
+// only advance past the visible ones.
+namespace cull_kernels {
+
+inline uint32_t scalar(const CullStore &store, const FrustumPlanes &planes,
+                       uint32_t begin, uint32_t end, uint32_t *out) {
+  uint32_t count = 0;
+  for (uint32_t i = begin; i < end; i++) {
+    bool visible = true;
+    for (const glm::vec4 &plane : planes)
+      visible &= plane.x * store.center_x[i] + plane.y * store.center_y[i] +
+                     plane.z * store.center_z[i] + plane.w >=
+                 -store.radius[i];
+    out[count] = i;
+    count += visible;
+  }
+  return count;
+}
+
+#if B_CULL_X86
+__attribute__((target("sse2"))) inline uint32_t
+sse(const CullStore &store, const FrustumPlanes &planes, uint32_t begin,
+    uint32_t end, uint32_t *out) {
+  __m128 broadcast[6][4];
+  for (uint32_t p = 0; p < planes.size(); p++)
+    for (uint32_t c = 0; c < 4; c++)
+      broadcast[p][c] = _mm_set1_ps(planes[p][c]);
+
+  uint32_t count = 0;
+  uint32_t i = begin;
+  for (; i + 4 <= end; i += 4) {
+    __m128 x = _mm_loadu_ps(store.center_x.data() + i);
+    __m128 y = _mm_loadu_ps(store.center_y.data() + i);
+    __m128 z = _mm_loadu_ps(store.center_z.data() + i);
+    __m128 neg_radius =
+        _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(store.radius.data() + i));
+
+    __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    for (const auto &plane : broadcast) {
+      __m128 distance = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(x, plane[0]), _mm_mul_ps(y, plane[1])),
+          _mm_add_ps(_mm_mul_ps(z, plane[2]), plane[3]));
+      inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, neg_radius));
+    }
+
+    uint32_t mask = _mm_movemask_ps(inside);
+    for (uint32_t lane = 0; lane < 4; lane++) {
+      out[count] = i + lane;
+      count += (mask >> lane) & 1;
+    }
+  }
+  return count + scalar(store, planes, i, end, out + count);
+}
+
+__attribute__((target("avx2"))) inline uint32_t
+avx2(const CullStore &store, const FrustumPlanes &planes, uint32_t begin,
+     uint32_t end, uint32_t *out) {
+  __m256 broadcast[6][4];
+  for (uint32_t p = 0; p < planes.size(); p++)
+    for (uint32_t c = 0; c < 4; c++)
+      broadcast[p][c] = _mm256_set1_ps(planes[p][c]);
+
+  // Index of every lane, stored whole and advanced past the visible ones
+  const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+  uint32_t count = 0;
+  uint32_t i = begin;
+  for (; i + 8 <= end; i += 8) {
+    __m256 x = _mm256_loadu_ps(store.center_x.data() + i);
+    __m256 y = _mm256_loadu_ps(store.center_y.data() + i);
+    __m256 z = _mm256_loadu_ps(store.center_z.data() + i);
+    __m256 neg_radius = _mm256_sub_ps(_mm256_setzero_ps(),
+                                      _mm256_loadu_ps(store.radius.data() + i));
+
+    __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    for (const auto &plane : broadcast) {
+      __m256 distance = _mm256_add_ps(
+          _mm256_add_ps(_mm256_mul_ps(x, plane[0]), _mm256_mul_ps(y, plane[1])),
+          _mm256_add_ps(_mm256_mul_ps(z, plane[2]), plane[3]));
+      inside = _mm256_and_ps(inside,
+                             _mm256_cmp_ps(distance, neg_radius, _CMP_GE_OQ));
+    }
+
+    uint32_t mask = _mm256_movemask_ps(inside);
+    // Nothing to compact when the whole group is in or out
+    if (mask == 0xff) {
+      _mm256_storeu_si256((__m256i *)(out + count),
+                          _mm256_add_epi32(lanes, _mm256_set1_epi32(i)));
+      count += 8;
+    } else if (mask != 0) {
+      for (uint32_t lane = 0; lane < 8; lane++) {
+        out[count] = i + lane;
+        count += (mask >> lane) & 1;
+      }
+    }
+  }
+  return count + scalar(store, planes, i, end, out + count);
+}
+#endif
+
+} // namespace cull_kernels
+
+// Tests the bounding spheres of a CullStore against the view frustum, in
+// chunks spread over a few threads. The indices of the visible objects are
+// left in `visible`, in object order.
+struct FrustumCuller {
+  struct Stats {
+    uint32_t tested = 0;
+    uint32_t visible = 0;
+    double cull_ms = 0.0;
+  };
+
+  CullKernel kernel = best_cull_kernel();
+  // The calling thread culls as well, one thread means no workers
+  uint32_t thread_count = 1;
+  // Smaller chunks are not worth waking a worker for
+  uint32_t chunk_size = 16384;
+
+  // Room for every object, only the first visible_count entries are valid
+  std::vector<uint32_t> visible;
+  uint32_t visible_count = 0;
+  Stats stats;
+
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable job_posted, job_done;
+  uint64_t generation = 0;
+  uint32_t workers_busy = 0;
+  bool stopping = false;
+
+  // The job being culled, only written while the workers are idle
+  const CullStore *job_store = nullptr;
+  FrustumPlanes job_planes = {};
+  uint32_t job_chunk_count = 0;
+  std::vector<uint32_t> chunk_counts;
+  std::atomic<uint32_t> next_chunk{0};
+
+  FrustumCuller() = default;
+  FrustumCuller(const FrustumCuller &) = delete;
+  FrustumCuller &operator=(const FrustumCuller &) = delete;
+
+  ~FrustumCuller() { stop(); }
+
+  // Zero threads picks the number of hardware threads
+  void init(uint32_t threads = 1) {
+    stop();
+    if (threads == 0)
+      threads = std::max(1u, std::thread::hardware_concurrency());
+    thread_count = threads;
+
+    stopping = false;
+    for (uint32_t i = 1; i < thread_count; i++)
+      workers.emplace_back([this]() { work(); });
+  }
+
+  uint32_t cull_range(const CullStore &store, const FrustumPlanes &planes,
+                      uint32_t begin, uint32_t end, uint32_t *out) const {
+    switch (kernel) {
+#if B_CULL_X86
+    case CullKernel::AVX2:
+      return cull_kernels::avx2(store, planes, begin, end, out);
+    case CullKernel::SSE:
+      return cull_kernels::sse(store, planes, begin, end, out);
+#endif
+    default:
+      return cull_kernels::scalar(store, planes, begin, end, out);
+    }
+  }
+
+  // Every chunk writes its indices at its own offset, compacted afterwards
+  void cull_chunks() {
+    uint32_t object_count = job_store->size();
+    for (uint32_t chunk = next_chunk++; chunk < job_chunk_count;
+         chunk = next_chunk++) {
+      uint32_t begin = chunk * chunk_size;
+      uint32_t end = std::min(object_count, begin + chunk_size);
+      chunk_counts[chunk] = cull_range(*job_store, job_planes, begin, end,
+                                       visible.data() + begin);
+    }
+  }
+
+  void work() {
+    uint64_t seen = 0;
+    while (true) {
+      {
+        std::unique_lock lock(mutex);
+        job_posted.wait(lock,
+                        [&]() { return stopping || generation != seen; });
+        if (stopping)
+          return;
+        seen = generation;
+      }
+
+      cull_chunks();
+
+      {
+        std::lock_guard lock(mutex);
+        workers_busy--;
+      }
+      job_done.notify_one();
+    }
+  }
+
+  // Returns the number of visible objects
+  uint32_t cull(const CullStore &store, const glm::mat4 &view_projection) {
+    auto start = std::chrono::steady_clock::now();
+    uint32_t object_count = store.size();
+
+    job_store = &store;
+    job_planes = frustum_planes(view_projection);
+    job_chunk_count = (object_count + chunk_size - 1) / chunk_size;
+    chunk_counts.resize(job_chunk_count);
+    next_chunk = 0;
+    if (visible.size() < object_count)
+      visible.resize(object_count);
+
+    if (job_chunk_count <= 1 || workers.empty()) {
+      cull_chunks();
+    } else {
+      {
+        std::lock_guard lock(mutex);
+        workers_busy = workers.size();
+        generation++;
+      }
+      job_posted.notify_all();
+
+      cull_chunks();
+
+      std::unique_lock lock(mutex);
+      job_done.wait(lock, [this]() { return workers_busy == 0; });
+    }
+
+    // Chunks only move towards the front, never over one not yet moved
+    visible_count = 0;
+    for (uint32_t chunk = 0; chunk < job_chunk_count; chunk++) {
+      const uint32_t *chunk_visible = visible.data() + chunk * chunk_size;
+      std::copy(chunk_visible, chunk_visible + chunk_counts[chunk],
+                visible.data() + visible_count);
+      visible_count += chunk_counts[chunk];
+    }
+
+    stats.tested = object_count;
+    stats.visible = visible_count;
+    stats.cull_ms = std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+    return visible_count;
+  }
+
+  void stop() {
+    {
+      std::lock_guard lock(mutex);
+      stopping = true;
+    }
+    job_posted.notify_all();
+
+    for (auto &worker : workers)
+      worker.join();
+    workers.clear();
+  }
+
+  void draw_imgui() {
+    ImGui::Begin("Culling");
+    ImGui::Text("%s kernel on %u threads", cull_kernel_name(kernel),
+                thread_count);
+    ImGui::Text("%u / %u visible, culled in %.3f ms", stats.visible,
+                stats.tested, stats.cull_ms);
+    ImGui::End();
+  }
+};
+
+} // namespace b::engine
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+
+#include "submission.hpp"
+
+namespace b::engine {
+
+// Destruction of GPU resources deferred until the GPU is provably done with
+// them, without waiting for the device. Entries are stamped with the frame
+// being built when they are pushed and run once that frame's fence has
+// signalled, and once the submission they depend on, e.g. an upload, has
+// completed.
+struct DeletionQueue {
+  struct Entry {
+    uint64_t frame;
+    SubmitTicket ticket;
+    std::function<void()> destroy;
+  };
+
+  std::deque<Entry> entries;
+  // Latest frame that may use a resource released now, set by the renderer
+  uint64_t frame = 0;
+
+  void push(std::function<void()> destroy, SubmitTicket ticket = {}) {
+    entries.push_back({frame, ticket, std::move(destroy)});
+  }
+
+  // Runs the entries whose frames are below `completed_frames` and whose
+  // tickets satisfy `is_complete`, in the order they were pushed
+  template <typename F>
+  void collect(uint64_t completed_frames, F is_complete) {
+    while (!entries.empty() && entries.front().frame < completed_frames &&
+           is_complete(entries.front().ticket)) {
+      // Popped first, a destructor may push further entries
+      auto destroy = std::move(entries.front().destroy);
+      entries.pop_front();
+      destroy();
+    }
+  }
+
+  // The device must be idle
+  void flush() {
+    while (!entries.empty()) {
+      auto destroy = std::move(entries.front().destroy);
+      entries.pop_front();
+      destroy();
+    }
+  }
+};
+
+} // namespace b::engine
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <imgui/imgui.h>
+#include <spdlog/fmt/fmt.h>
+#include <vulkan/vulkan.h>
+
+#include "scope_stats.hpp"
+
+namespace b::engine {
+
+// Present modes tried in order for a desired one. FIFO is always supported,
+// MAILBOX falls back to it rather than tearing.
+inline std::vector<VkPresentModeKHR>
+present_mode_fallbacks(VkPresentModeKHR desired) {
+  switch (desired) {
+  case VK_PRESENT_MODE_IMMEDIATE_KHR:
+    return {VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR,
+            VK_PRESENT_MODE_FIFO_KHR};
+  case VK_PRESENT_MODE_MAILBOX_KHR:
+    return {VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_FIFO_KHR};
+  default:
+    return {desired, VK_PRESENT_MODE_FIFO_KHR};
+  }
+}
+
+inline const char *present_mode_name(VkPresentModeKHR present_mode) {
+  switch (present_mode) {
+  case VK_PRESENT_MODE_IMMEDIATE_KHR:
+    return "immediate";
+  case VK_PRESENT_MODE_MAILBOX_KHR:
+    return "mailbox";
+  case VK_PRESENT_MODE_FIFO_KHR:
+    return "fifo";
+  case VK_PRESENT_MODE_FIFO_RELAXED_KHR:
+    return "fifo relaxed";
+  default:
+    return "other";
+  }
+}
+
+// Returns false for an unknown name
+inline bool parse_present_mode(const char *name,
+                               VkPresentModeKHR &present_mode) {
+  for (auto mode : {VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR,
+                    VK_PRESENT_MODE_FIFO_KHR}) {
+    if (std::strcmp(name, present_mode_name(mode)) == 0) {
+      present_mode = mode;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Frame rate cap and input latency tracking. Latency is measured from the
+// moment input is sampled to the moment the fence of the frame built from it
+// is seen signalled, i.e. when the GPU finished the frame. Presentation and
+// scanout come later still and are not included. The fence is polled every
+// frame, so the figure can run late by up to a frame of CPU time.
+struct FramePacer {
+  using clock = std::chrono::steady_clock;
+
+  // Frames per second, zero disables the cap
+  double fps_cap = 0.0;
+  // Waits for the GPU to drain before input is sampled, so frames are built
+  // from the freshest input instead of queueing up behind the GPU. Costs
+  // throughput when the CPU and the GPU could otherwise overlap.
+  bool low_latency = false;
+
+  clock::time_point next_frame;
+  // Input sample time of the frame being built, and of the frame last
+  // submitted from every frame in flight
+  clock::time_point pending_input;
+  std::vector<clock::time_point> input_times;
+
+  ScopeStats latency = {.name = "input to GPU done"};
+
+  void init(uint32_t frames_in_flight) {
+    input_times.assign(frames_in_flight, clock::time_point());
+  }
+
+  // Sleeps off the rest of the frame interval, the last millisecond is spun
+  // since sleeps overshoot
+  void wait_for_cap() {
+    auto now = clock::now();
+    if (fps_cap <= 0.0) {
+      next_frame = now;
+      return;
+    }
+
+    auto interval = std::chrono::duration_cast<clock::duration>(
+        std::chrono::duration<double>(1.0 / fps_cap));
+    if (now < next_frame) {
+      std::this_thread::sleep_until(next_frame - std::chrono::milliseconds(1));
+      while (clock::now() < next_frame)
+        std::this_thread::yield();
+    }
+    // A late frame does not make the next ones hurry
+    next_frame = std::max(next_frame, now) + interval;
+  }
+
+  void input_sampled() { pending_input = clock::now(); }
+
+  // The frame in flight is submitted, built from the pending input
+  void frame_submitted(uint32_t frame) {
+    input_times[frame] = pending_input;
+    pending_input = clock::time_point();
+  }
+
+  // The fence of the frame in flight was seen signalled
+  void frame_completed(uint32_t frame) {
+    if (input_times[frame] == clock::time_point())
+      return;
+
+    latency.push(std::chrono::duration<float, std::milli>(clock::now() -
+                                                          input_times[frame])
+                     .count(),
+                 false);
+    input_times[frame] = clock::time_point();
+  }
+
+  bool has_pending(uint32_t frame) const {
+    return input_times[frame] != clock::time_point();
+  }
+
+  // Returns true if another present mode was picked, which the caller applies
+  bool draw_imgui(VkPresentModeKHR active_mode,
+                  VkPresentModeKHR &requested_mode,
+                  uint32_t frames_in_flight) {
+    ImGui::Begin("Frame pacing");
+
+    bool changed = false;
+    if (ImGui::BeginCombo("present mode", present_mode_name(active_mode))) {
+      for (auto mode :
+           {VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR,
+            VK_PRESENT_MODE_FIFO_KHR}) {
+        if (ImGui::Selectable(present_mode_name(mode), mode == active_mode) &&
+            mode != active_mode) {
+          requested_mode = mode;
+          changed = true;
+        }
+      }
+      ImGui::EndCombo();
+    }
+
+    ImGui::Text("%u frames in flight", frames_in_flight);
+    float cap = fps_cap;
+    if (ImGui::InputFloat("fps cap", &cap, 10.0f, 60.0f, "%.0f"))
+      fps_cap = std::max(cap, 0.0f);
+    ImGui::Checkbox("low latency", &low_latency);
+
+    float max_ms = 0.0f;
+    for (size_t i = 0; i < latency.history_size; i++)
+      max_ms = std::max(max_ms, latency.history[i]);
+    auto overlay = fmt::format("avg {:.2f} ms, last {:.2f} ms",
+                               latency.average_ms(), latency.latest_ms);
+    ImGui::PlotHistogram(
+        latency.name.c_str(), latency.history.data(), latency.history_size,
+        latency.history_size < ScopeStats::HISTORY ? 0 : latency.history_head,
+        overlay.c_str(), 0.0f, max_ms * 1.25f, ImVec2(0, 48));
+
+    ImGui::End();
+    return changed;
+  }
+};
+
+} // namespace b::engine
@@ -0,0 +1,207 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+#include <glm/glm.hpp>
+#include <vulkan/vulkan.h>
+
+#include "bootstrap.hpp"
+
+namespace b::engine {
+
+// Matches `Frame` in shader.vert, instanced.vert and objects.vert
+struct FrameUniforms {
+  glm::mat4 view_projection;
+};
+
+// Matches `Draw` in shader.vert
+struct DrawPushConstants {
+  // Index in the transforms bound at binding 1
+  uint32_t object;
+  // Index in the materials of the bindless set
+  uint32_t material;
+};
+
+// Uniform and storage data written by the CPU every frame, bump allocated
+// from a persistently mapped buffer and bound through dynamic offsets, so
+// nothing is uploaded and no descriptor is written after init. Every frame
+// in flight owns a region of the buffer, reused once its fence signalled.
+//
+// The frame set has a dynamic uniform buffer at binding 0 and a dynamic
+// storage buffer at binding 1, both are given an offset when bound.
+struct FrameRing {
+  struct Allocation {
+    void *data;
+    // Dynamic offset of the allocation
+    uint32_t offset;
+  };
+
+  // Bytes per frame, has to be set before init
+  VkDeviceSize capacity = 8 << 20;
+  // Size of the descriptor windows starting at the dynamic offsets, a
+  // uniform block or storage array must fit in them
+  static constexpr VkDeviceSize UNIFORM_RANGE = 256;
+  VkDeviceSize storage_range = 2 << 20;
+
+  VkBuffer buffer = VK_NULL_HANDLE;
+  VmaAllocation allocation = VK_NULL_HANDLE;
+  uint8_t *mapped = nullptr;
+  VkDeviceSize alignment = 1;
+
+  uint32_t current = 0;
+  VkDeviceSize frame_begin = 0;
+  VkDeviceSize head = 0;
+
+  VkDescriptorSetLayout set_layout;
+  VkDescriptorPool descriptor_pool;
+  VkDescriptorSet descriptor_set;
+
+  void init_buffer(BootstrapInfo &bootstrap, uint32_t frames_in_flight) {
+    const auto &limits = bootstrap.physical_device.properties.limits;
+    alignment = std::max(limits.minUniformBufferOffsetAlignment,
+                         limits.minStorageBufferOffsetAlignment);
+    capacity = (capacity + alignment - 1) / alignment * alignment;
+    storage_range = std::min<VkDeviceSize>(storage_range,
+                                           limits.maxStorageBufferRange);
+
+    // The windows of the last allocations reach past the last frame
+    VkBufferCreateInfo buffer_info = {};
+    buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_info.size = capacity * frames_in_flight +
+                       std::max(UNIFORM_RANGE, storage_range);
+    buffer_info.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT |
+                        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    VmaAllocationCreateInfo vmalloc_info = {};
+    vmalloc_info.usage = VMA_MEMORY_USAGE_AUTO;
+    vmalloc_info.flags =
+        VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
+        VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+    VmaAllocationInfo allocation_info = {};
+    CHECK_VK(vmaCreateBuffer(bootstrap.allocator, &buffer_info, &vmalloc_info,
+                             &buffer, &allocation, &allocation_info));
+    mapped = (uint8_t *)allocation_info.pMappedData;
+    CHECK(mapped);
+  }
+
+  void init_descriptors(BootstrapInfo &bootstrap) {
+    std::array<VkDescriptorSetLayoutBinding, 2> bindings = {};
+    bindings[0].binding = 0;
+    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    bindings[0].descriptorCount = 1;
+    // The GPU scene's cull tests against the view projection
+    bindings[0].stageFlags =
+        VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+    bindings[1] = bindings[0];
+    bindings[1].binding = 1;
+    bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+
+    VkDescriptorSetLayoutCreateInfo layout_info = {};
+    layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layout_info.bindingCount = bindings.size();
+    layout_info.pBindings = bindings.data();
+    CHECK_VK(bootstrap.dispatch.createDescriptorSetLayout(&layout_info, NULL,
+                                                          &set_layout));
+
+    std::array<VkDescriptorPoolSize, 2> pool_sizes = {
+        VkDescriptorPoolSize{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1},
+        VkDescriptorPoolSize{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1},
+    };
+    VkDescriptorPoolCreateInfo pool_info = {};
+    pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    pool_info.maxSets = 1;
+    pool_info.poolSizeCount = pool_sizes.size();
+    pool_info.pPoolSizes = pool_sizes.data();
+    CHECK_VK(bootstrap.dispatch.createDescriptorPool(&pool_info, NULL,
+                                                     &descriptor_pool));
+
+    VkDescriptorSetAllocateInfo set_info = {};
+    set_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    set_info.descriptorPool = descriptor_pool;
+    set_info.descriptorSetCount = 1;
+    set_info.pSetLayouts = &set_layout;
+    CHECK_VK(
+        bootstrap.dispatch.allocateDescriptorSets(&set_info, &descriptor_set));
+
+    std::array<VkDescriptorBufferInfo, 2> buffer_infos = {
+        VkDescriptorBufferInfo{buffer, 0, UNIFORM_RANGE},
+        VkDescriptorBufferInfo{buffer, 0, storage_range},
+    };
+
+    std::array<VkWriteDescriptorSet, 2> writes = {};
+    for (uint32_t i = 0; i < writes.size(); i++) {
+      writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      writes[i].dstSet = descriptor_set;
+      writes[i].dstBinding = i;
+      writes[i].descriptorCount = 1;
+      writes[i].descriptorType = bindings[i].descriptorType;
+      writes[i].pBufferInfo = &buffer_infos[i];
+    }
+    bootstrap.dispatch.updateDescriptorSets(writes.size(), writes.data(), 0,
+                                            nullptr);
+  }
+
+  void init(BootstrapInfo &bootstrap, uint32_t frames_in_flight) {
+    init_buffer(bootstrap, frames_in_flight);
+    init_descriptors(bootstrap);
+  }
+
+  // The fence of the frame must have been waited on
+  void begin_frame(uint32_t frame) {
+    current = frame;
+    frame_begin = head = capacity * frame;
+  }
+
+  // Bump allocates `size` bytes of the current frame. The memory is
+  // write-combined, write it sequentially and never read it back.
+  Allocation allocate(VkDeviceSize size) {
+    VkDeviceSize offset = (head + alignment - 1) / alignment * alignment;
+    CHECK_REPORT_FMT(offset + size <= frame_begin + capacity,
+                     "The frame ring holds {} bytes per frame", capacity);
+    head = offset + size;
+    return {mapped + offset, (uint32_t)offset};
+  }
+
+  // Returns the dynamic offset for binding 0
+  template <typename T> uint32_t push_uniform(const T &value) {
+    static_assert(sizeof(T) <= UNIFORM_RANGE,
+                  "Uniform blocks have to fit in FrameRing::UNIFORM_RANGE");
+    Allocation allocation = allocate(sizeof(T));
+    std::memcpy(allocation.data, &value, sizeof(T));
+    return allocation.offset;
+  }
+
+  // Room for an array of `count` elements read through binding 1 at the
+  // returned offset
+  template <typename T> T *push_storage(uint32_t count, uint32_t &offset) {
+    CHECK_REPORT_FMT(sizeof(T) * count <= storage_range,
+                     "Storage arrays are limited to {} bytes", storage_range);
+    Allocation allocation = allocate(sizeof(T) * count);
+    offset = allocation.offset;
+    return (T *)allocation.data;
+  }
+
+  // Makes the writes of the current frame visible to the device, a no-op on
+  // coherent memory
+  void flush(BootstrapInfo &bootstrap) {
+    if (head > frame_begin)
+      CHECK_VK(vmaFlushAllocation(bootstrap.allocator, allocation,
+                                  frame_begin, head - frame_begin));
+  }
+
+  void cmd_bind(BootstrapInfo &bootstrap, VkCommandBuffer command_buffer,
+                VkPipelineBindPoint bind_point, VkPipelineLayout layout,
+                uint32_t set, uint32_t uniform_offset,
+                uint32_t storage_offset) {
+    uint32_t offsets[] = {uniform_offset, storage_offset};
+    bootstrap.dispatch.cmdBindDescriptorSets(command_buffer, bind_point,
+                                             layout, set, 1, &descriptor_set,
+                                             2, offsets);
+  }
+};
+
+} // namespace b::engine
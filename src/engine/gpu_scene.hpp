@@ -0,0 +1,492 @@
+#pragma once
+
+#include <array>
+#include <vector>
+
+#include <imgui/imgui.h>
+
+#include <glm/glm.hpp>
+#include <vulkan/vulkan.h>
+
+#include "arena.hpp"
+#include "bindless.hpp"
+#include "bootstrap.hpp"
+#include "culling.hpp"
+#include "frame_ring.hpp"
+#include "hiz.hpp"
+#include "pipeline.hpp"
+#include "scope_stats.hpp"
+#include "upload.hpp"
+#include "vertex.hpp"
+
+namespace b::engine {
+
+// Matches `Object` in cull.comp and objects.vert
+struct GpuObject {
+  glm::mat4 transform;
+  // Object space bounding sphere, w is the radius
+  glm::vec4 bounds;
+  // Index count, first index, vertex offset, material
+  glm::uvec4 mesh;
+};
+
+// Matches the PHASE_ constants in cull.comp
+enum class CullPhase : uint32_t {
+  // Every object in the frustum, without occlusion culling
+  ALL,
+  // Objects visible last frame, drawn before the depth pyramid is built
+  EARLY,
+  // Every object tested against the pyramid, draws those not drawn early
+  LATE,
+};
+
+struct CullPushConstants {
+  FrustumPlanes planes;
+  uint32_t object_count;
+  CullPhase phase;
+  // Size of the pyramid's level 0
+  glm::vec2 pyramid_size;
+};
+
+// Matches `Counts` in cull.comp
+struct CullCounts {
+  uint32_t early_draws;
+  uint32_t late_draws;
+  // Objects in the frustum the late phase culled, and the early one did
+  // not draw
+  uint32_t occluded;
+};
+
+// Per-object data in a storage buffer, culled by a compute pass that
+// compacts the surviving draws into an indirect buffer drawn with a single
+// vkCmdDrawIndexedIndirectCount. The recorded commands are the same whatever
+// the object count.
+//
+// With occlusion culling the scene is drawn in two phases. The objects
+// visible last frame are drawn first and the depth pyramid is built from
+// their depth, then every object is tested against it and those that were
+// not drawn yet are drawn on top. Visibility is kept per object on the GPU.
+//
+// Every object has to live in the same geometry arena page and use the same
+// index type.
+struct GpuScene {
+  std::vector<GpuObject> objects;
+  VkBuffer vert_buffer = VK_NULL_HANDLE;
+  VkBuffer index_buffer = VK_NULL_HANDLE;
+  VkIndexType index_type = VK_INDEX_TYPE_UINT32;
+
+  VkBuffer object_buffer = VK_NULL_HANDLE;
+  VmaAllocation object_allocation = VK_NULL_HANDLE;
+  VkBuffer draw_buffer = VK_NULL_HANDLE;
+  VmaAllocation draw_allocation = VK_NULL_HANDLE;
+  VkBuffer count_buffer = VK_NULL_HANDLE;
+  VmaAllocation count_allocation = VK_NULL_HANDLE;
+  VkBuffer visibility_buffer = VK_NULL_HANDLE;
+  VmaAllocation visibility_allocation = VK_NULL_HANDLE;
+  // Number of objects in the uploaded buffers
+  uint32_t object_count = 0;
+
+  // Counts copied back for every frame in flight
+  VkBuffer readback_buffer = VK_NULL_HANDLE;
+  VmaAllocation readback_allocation = VK_NULL_HANDLE;
+  CullCounts *readback = nullptr;
+  // Whether each frame in flight was drawn with occlusion culling, -1 until
+  // it was drawn at all
+  std::vector<int8_t> frame_occlusion;
+
+  // Of the last completed frame
+  CullCounts counts = {};
+  // GPU time of the scene scope, with and without occlusion culling
+  ScopeStats scene_occlusion = {.name = "scene, occlusion culled"};
+  ScopeStats scene_frustum = {.name = "scene, frustum culled"};
+
+  VkDescriptorSetLayout set_layout;
+  VkDescriptorPool descriptor_pool;
+  VkDescriptorSet descriptor_set = VK_NULL_HANDLE;
+
+  VkPipelineLayout cull_layout;
+  VkPipelineLayout draw_layout;
+  PipelineHandle cull_pipeline;
+  PipelineHandle draw_pipeline;
+
+  void init_descriptors(BootstrapInfo &bootstrap) {
+    std::array<VkDescriptorSetLayoutBinding, 4> bindings = {};
+    for (uint32_t i = 0; i < bindings.size(); i++) {
+      bindings[i].binding = i;
+      bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      bindings[i].descriptorCount = 1;
+      bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+    bindings[0].stageFlags |= VK_SHADER_STAGE_VERTEX_BIT;
+
+    VkDescriptorSetLayoutCreateInfo layout_info = {};
+    layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layout_info.bindingCount = bindings.size();
+    layout_info.pBindings = bindings.data();
+    CHECK_VK(bootstrap.dispatch.createDescriptorSetLayout(&layout_info, NULL,
+                                                          &set_layout));
+
+    VkDescriptorPoolSize pool_size = {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4};
+    VkDescriptorPoolCreateInfo pool_info = {};
+    pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    pool_info.maxSets = 1;
+    pool_info.poolSizeCount = 1;
+    pool_info.pPoolSizes = &pool_size;
+    CHECK_VK(bootstrap.dispatch.createDescriptorPool(&pool_info, NULL,
+                                                     &descriptor_pool));
+  }
+
+  // The draw reads the frame uniforms from set 0, the materials from set 1
+  // and the objects from set 2, like the other scene pipelines. The cull
+  // reads the objects from set 0, the pyramid from set 1 and the frame
+  // uniforms from set 2.
+  void init_pipelines(BootstrapInfo &bootstrap, PipelineCompiler &pipelines,
+                      VkRenderPass render_pass,
+                      VkDescriptorSetLayout frame_set_layout,
+                      VkDescriptorSetLayout bindless_set_layout,
+                      VkDescriptorSetLayout pyramid_set_layout) {
+    VkPushConstantRange push_range = {};
+    push_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    push_range.size = sizeof(CullPushConstants);
+
+    std::array<VkDescriptorSetLayout, 3> cull_set_layouts = {
+        set_layout, pyramid_set_layout, frame_set_layout};
+    VkPipelineLayoutCreateInfo layout_info = {};
+    layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    layout_info.setLayoutCount = cull_set_layouts.size();
+    layout_info.pSetLayouts = cull_set_layouts.data();
+    layout_info.pushConstantRangeCount = 1;
+    layout_info.pPushConstantRanges = &push_range;
+    CHECK_VK(bootstrap.dispatch.createPipelineLayout(&layout_info, NULL,
+                                                     &cull_layout));
+
+    std::array<VkDescriptorSetLayout, 3> draw_set_layouts = {
+        frame_set_layout, bindless_set_layout, set_layout};
+    layout_info.setLayoutCount = draw_set_layouts.size();
+    layout_info.pSetLayouts = draw_set_layouts.data();
+    layout_info.pushConstantRangeCount = 0;
+    CHECK_VK(bootstrap.dispatch.createPipelineLayout(&layout_info, NULL,
+                                                     &draw_layout));
+
+    ComputePipelineDesc cull_desc;
+    cull_desc.name = "cull";
+    cull_desc.comp_shader = "cull.comp";
+    cull_desc.layout = cull_layout;
+    cull_pipeline = pipelines.compile(bootstrap, cull_desc);
+
+    auto attribute_descriptions =
+        VertexLayout<PackedVertex>::attribute_descriptions();
+
+    GraphicsPipelineDesc draw_desc;
+    draw_desc.name = "objects";
+    draw_desc.vert_shader = "objects.vert";
+    draw_desc.frag_shader = "shader.frag";
+    draw_desc.bindings = {VertexLayout<PackedVertex>::binding_description()};
+    draw_desc.attributes = {attribute_descriptions.begin(),
+                            attribute_descriptions.end()};
+    draw_desc.layout = draw_layout;
+    draw_desc.render_pass = render_pass;
+    draw_pipeline = pipelines.compile(bootstrap, draw_desc);
+  }
+
+  void init_readback(BootstrapInfo &bootstrap, uint32_t frames_in_flight) {
+    VkBufferCreateInfo buffer_info = {};
+    buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_info.size = sizeof(CullCounts) * frames_in_flight;
+    buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    VmaAllocationCreateInfo vmalloc_info = {};
+    vmalloc_info.usage = VMA_MEMORY_USAGE_AUTO;
+    vmalloc_info.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT |
+                         VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+    VmaAllocationInfo allocation_info = {};
+    CHECK_VK(vmaCreateBuffer(bootstrap.allocator, &buffer_info, &vmalloc_info,
+                             &readback_buffer, &readback_allocation,
+                             &allocation_info));
+    readback = (CullCounts *)allocation_info.pMappedData;
+    CHECK(readback);
+    frame_occlusion.assign(frames_in_flight, -1);
+  }
+
+  void init(BootstrapInfo &bootstrap, PipelineCompiler &pipelines,
+            VkRenderPass render_pass, VkDescriptorSetLayout frame_set_layout,
+            VkDescriptorSetLayout bindless_set_layout,
+            VkDescriptorSetLayout pyramid_set_layout,
+            uint32_t frames_in_flight) {
+    init_descriptors(bootstrap);
+    init_pipelines(bootstrap, pipelines, render_pass, frame_set_layout,
+                   bindless_set_layout, pyramid_set_layout);
+    init_readback(bootstrap, frames_in_flight);
+  }
+
+  uint32_t add_object(const Mesh &mesh, const glm::mat4 &transform,
+                      const glm::vec4 &bounds, uint32_t material = 0) {
+    if (objects.empty()) {
+      vert_buffer = mesh.vert_buffer;
+      index_buffer = mesh.index_buffer;
+      index_type = mesh.index_type;
+    }
+    CHECK_REPORT_STR(mesh.vert_buffer == vert_buffer,
+                     "Every object of the scene must share an arena page");
+    CHECK_REPORT_STR(mesh.index_type == index_type,
+                     "Every object of the scene must share an index type");
+
+    GpuObject object = {};
+    object.transform = transform;
+    object.bounds = bounds;
+    object.mesh = {mesh.index_count, mesh.first_index,
+                   (uint32_t)mesh.vertex_offset, material};
+    objects.push_back(object);
+    return objects.size() - 1;
+  }
+
+  // Uploads the objects and sizes the draw buffers, may only happen once
+  void commit(BootstrapInfo &bootstrap, Uploader &uploader) {
+    CHECK_REPORT_STR(object_buffer == VK_NULL_HANDLE,
+                     "The scene has already been committed");
+    CHECK_REPORT_STR(!objects.empty(), "The scene has no objects");
+
+    object_count = objects.size();
+    uploader.create_buffer(bootstrap, objects.data(),
+                           sizeof(GpuObject) * objects.size(),
+                           VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, &object_buffer,
+                           &object_allocation);
+    // Nothing was visible before the first frame, its early phase is empty
+    std::vector<uint32_t> visibility(object_count, 0);
+    uploader.create_buffer(bootstrap, visibility.data(),
+                           sizeof(uint32_t) * visibility.size(),
+                           VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                           &visibility_buffer, &visibility_allocation);
+
+    VmaAllocationCreateInfo vmalloc_info = {};
+    vmalloc_info.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+
+    VkBufferCreateInfo buffer_info = {};
+    buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    // The late phase's draws follow the early phase's
+    buffer_info.size =
+        sizeof(VkDrawIndexedIndirectCommand) * object_count * 2;
+    buffer_info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                        VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+    buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    CHECK_VK(vmaCreateBuffer(bootstrap.allocator, &buffer_info, &vmalloc_info,
+                             &draw_buffer, &draw_allocation, nullptr));
+
+    buffer_info.size = sizeof(CullCounts);
+    buffer_info.usage |=
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    CHECK_VK(vmaCreateBuffer(bootstrap.allocator, &buffer_info, &vmalloc_info,
+                             &count_buffer, &count_allocation, nullptr));
+
+    VkDescriptorSetAllocateInfo set_info = {};
+    set_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    set_info.descriptorPool = descriptor_pool;
+    set_info.descriptorSetCount = 1;
+    set_info.pSetLayouts = &set_layout;
+    CHECK_VK(
+        bootstrap.dispatch.allocateDescriptorSets(&set_info, &descriptor_set));
+
+    std::array<VkDescriptorBufferInfo, 4> buffer_infos = {
+        VkDescriptorBufferInfo{object_buffer, 0, VK_WHOLE_SIZE},
+        VkDescriptorBufferInfo{draw_buffer, 0, VK_WHOLE_SIZE},
+        VkDescriptorBufferInfo{count_buffer, 0, VK_WHOLE_SIZE},
+        VkDescriptorBufferInfo{visibility_buffer, 0, VK_WHOLE_SIZE},
+    };
+
+    std::array<VkWriteDescriptorSet, 4> writes = {};
+    for (uint32_t i = 0; i < writes.size(); i++) {
+      writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      writes[i].dstSet = descriptor_set;
+      writes[i].dstBinding = i;
+      writes[i].descriptorCount = 1;
+      writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      writes[i].pBufferInfo = &buffer_infos[i];
+    }
+    bootstrap.dispatch.updateDescriptorSets(writes.size(), writes.data(), 0,
+                                            nullptr);
+  }
+
+  bool is_ready(const PipelineCompiler &pipelines) const {
+    return descriptor_set != VK_NULL_HANDLE &&
+           pipelines.is_ready(cull_pipeline) &&
+           pipelines.is_ready(draw_pipeline);
+  }
+
+  // Has to be recorded outside of the render pass. The early and the late
+  // phase share the counts cleared by the early one, the late phase reads
+  // the pyramid built in between.
+  void cmd_cull(BootstrapInfo &bootstrap, PipelineCompiler &pipelines,
+                VkCommandBuffer command_buffer,
+                const glm::mat4 &view_projection, CullPhase phase,
+                FrameRing &frame_ring, uint32_t frame_uniform_offset,
+                const DepthPyramid &pyramid) {
+    if (phase != CullPhase::LATE) {
+      // The previous frame may still be reading the draws and counts, and
+      // its late or only phase wrote the visibility read now
+      VkMemoryBarrier reuse_barrier = {};
+      reuse_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+      reuse_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+      reuse_barrier.dstAccessMask =
+          VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+      bootstrap.dispatch.cmdPipelineBarrier(
+          command_buffer,
+          VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+              VK_PIPELINE_STAGE_TRANSFER_BIT |
+              VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+          VK_PIPELINE_STAGE_TRANSFER_BIT |
+              VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+          0, 1, &reuse_barrier, 0, nullptr, 0, nullptr);
+
+      bootstrap.dispatch.cmdFillBuffer(command_buffer, count_buffer, 0,
+                                       sizeof(CullCounts), 0);
+
+      VkMemoryBarrier clear_barrier = {};
+      clear_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+      clear_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+      clear_barrier.dstAccessMask =
+          VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+      bootstrap.dispatch.cmdPipelineBarrier(
+          command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+          VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &clear_barrier, 0,
+          nullptr, 0, nullptr);
+    }
+
+    CullPushConstants push = {};
+    push.planes = frustum_planes(view_projection);
+    push.object_count = object_count;
+    push.phase = phase;
+    push.pyramid_size = {pyramid.targets.extent.width,
+                         pyramid.targets.extent.height};
+
+    bootstrap.dispatch.cmdBindPipeline(command_buffer,
+                                       VK_PIPELINE_BIND_POINT_COMPUTE,
+                                       pipelines.get(cull_pipeline));
+    std::array<VkDescriptorSet, 2> sets = {descriptor_set,
+                                           pyramid.targets.cull_set};
+    bootstrap.dispatch.cmdBindDescriptorSets(
+        command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, cull_layout, 0,
+        sets.size(), sets.data(), 0, nullptr);
+    frame_ring.cmd_bind(bootstrap, command_buffer,
+                        VK_PIPELINE_BIND_POINT_COMPUTE, cull_layout, 2,
+                        frame_uniform_offset, 0);
+    bootstrap.dispatch.cmdPushConstants(command_buffer, cull_layout,
+                                        VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                                        sizeof(push), &push);
+    bootstrap.dispatch.cmdDispatch(command_buffer, (object_count + 63) / 64, 1,
+                                   1);
+
+    // The late phase also reads the visibility the early one left alone
+    VkMemoryBarrier cull_barrier = {};
+    cull_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    cull_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    cull_barrier.dstAccessMask =
+        VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+    bootstrap.dispatch.cmdPipelineBarrier(
+        command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        0, 1, &cull_barrier, 0, nullptr, 0, nullptr);
+  }
+
+  // Has to be recorded inside of the render pass, after cmd_cull of the
+  // same phase
+  void cmd_draw(BootstrapInfo &bootstrap, PipelineCompiler &pipelines,
+                VkCommandBuffer command_buffer, FrameRing &frame_ring,
+                uint32_t frame_uniform_offset, BindlessResources &bindless,
+                CullPhase phase) {
+    bootstrap.dispatch.cmdBindPipeline(command_buffer,
+                                       VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                       pipelines.get(draw_pipeline));
+    frame_ring.cmd_bind(bootstrap, command_buffer,
+                        VK_PIPELINE_BIND_POINT_GRAPHICS, draw_layout, 0,
+                        frame_uniform_offset, 0);
+    bindless.cmd_bind(bootstrap, command_buffer,
+                      VK_PIPELINE_BIND_POINT_GRAPHICS, draw_layout, 1);
+    bootstrap.dispatch.cmdBindDescriptorSets(
+        command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, draw_layout, 2, 1,
+        &descriptor_set, 0, nullptr);
+
+    VkDeviceSize offset = 0;
+    bootstrap.dispatch.cmdBindVertexBuffers(command_buffer, 0, 1, &vert_buffer,
+                                            &offset);
+    bootstrap.dispatch.cmdBindIndexBuffer(command_buffer, index_buffer, 0,
+                                          index_type);
+
+    uint32_t list = phase == CullPhase::LATE ? 1 : 0;
+    bootstrap.dispatch.cmdDrawIndexedIndirectCount(
+        command_buffer, draw_buffer,
+        sizeof(VkDrawIndexedIndirectCommand) * object_count * list,
+        count_buffer, sizeof(uint32_t) * list, object_count,
+        sizeof(VkDrawIndexedIndirectCommand));
+  }
+
+  // Copies the counts of the frame for begin_frame to read once its fence
+  // signalled, recorded after the last cull of the frame
+  void cmd_read_counts(BootstrapInfo &bootstrap, VkCommandBuffer command_buffer,
+                       uint32_t frame, bool occlusion) {
+    VkMemoryBarrier cull_barrier = {};
+    cull_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    cull_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    cull_barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    bootstrap.dispatch.cmdPipelineBarrier(
+        command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &cull_barrier, 0, nullptr, 0,
+        nullptr);
+
+    VkBufferCopy region = {0, sizeof(CullCounts) * frame, sizeof(CullCounts)};
+    bootstrap.dispatch.cmdCopyBuffer(command_buffer, count_buffer,
+                                     readback_buffer, 1, &region);
+
+    VkMemoryBarrier host_barrier = {};
+    host_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    host_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    host_barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    bootstrap.dispatch.cmdPipelineBarrier(
+        command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &host_barrier, 0, nullptr, 0,
+        nullptr);
+
+    frame_occlusion[frame] = occlusion;
+  }
+
+  // The fence of the frame must have been waited on. `scene_ms` is the GPU
+  // time of the scene scope the profiler collected for the same frame,
+  // negative without timestamps.
+  void begin_frame(BootstrapInfo &bootstrap, uint32_t frame,
+                   float scene_ms) {
+    if (frame_occlusion.empty() || frame_occlusion[frame] < 0)
+      return;
+
+    CHECK_VK(vmaInvalidateAllocation(bootstrap.allocator, readback_allocation,
+                                     sizeof(CullCounts) * frame,
+                                     sizeof(CullCounts)));
+    counts = readback[frame];
+    if (scene_ms >= 0.0f)
+      (frame_occlusion[frame] ? scene_occlusion : scene_frustum)
+          .push(scene_ms, false);
+    frame_occlusion[frame] = -1;
+  }
+
+  // Returns whether occlusion culling is to be used
+  bool draw_imgui(bool occlusion_culling) {
+    ImGui::Begin("Occlusion culling");
+    ImGui::Checkbox("enabled", &occlusion_culling);
+    ImGui::Text("%u objects, %u drawn early, %u drawn late", object_count,
+                counts.early_draws, counts.late_draws);
+    ImGui::Text("%u occluded", counts.occluded);
+
+    // Compares the frames drawn either way, toggle to measure both
+    float with_ms = scene_occlusion.average_ms();
+    float without_ms = scene_frustum.average_ms();
+    ImGui::Text("scene %.3f ms occlusion culled, %.3f ms frustum culled",
+                with_ms, without_ms);
+    if (scene_occlusion.history_size > 0 && scene_frustum.history_size > 0)
+      ImGui::Text("%.3f ms saved", without_ms - with_ms);
+    ImGui::End();
+    return occlusion_culling;
+  }
+};
+
+} // namespace b::engine
@@ -0,0 +1,397 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <vulkan/vulkan.h>
+
+#include "bootstrap.hpp"
+#include "pipeline.hpp"
+
+namespace b::engine {
+
+// Matches `Reduce` in hiz.comp
+struct HiZPushConstants {
+  glm::ivec2 src_size;
+  glm::ivec2 dst_size;
+};
+
+// Depth target of the scene pass and its hierarchical-Z pyramid, where every
+// texel holds the farthest depth of the texels it covers one level below.
+// A box is hidden when its nearest depth is farther than the pyramid texels
+// covering it, at a level where it spans at most two of them.
+//
+// The render pass leaves the depth in SHADER_READ_ONLY_OPTIMAL, the pyramid
+// is in GENERAL while built and sampled. Both are sized after the swapchain
+// and replaced along with it, the old ones are destroyed through the
+// deletion queue.
+struct DepthPyramid {
+  struct Targets {
+    VkImage depth = VK_NULL_HANDLE;
+    VmaAllocation depth_allocation = VK_NULL_HANDLE;
+    VkImageView depth_view = VK_NULL_HANDLE;
+
+    VkImage pyramid = VK_NULL_HANDLE;
+    VmaAllocation pyramid_allocation = VK_NULL_HANDLE;
+    // Every level, sampled by the culling pass
+    VkImageView pyramid_view = VK_NULL_HANDLE;
+    // A single level each, written by the build
+    std::vector<VkImageView> level_views;
+
+    VkDescriptorPool descriptor_pool = VK_NULL_HANDLE;
+    // Reduce the level below, or the depth for level 0, into each level
+    std::vector<VkDescriptorSet> build_sets;
+    VkDescriptorSet cull_set = VK_NULL_HANDLE;
+
+    VkExtent2D depth_extent = {};
+    // Level 0 is the largest power of two that fits in the depth
+    VkExtent2D extent = {};
+    uint32_t levels = 0;
+    // Whether the pyramid has left UNDEFINED, see cmd_initialize
+    bool initialized = false;
+  };
+
+  VkFormat depth_format = VK_FORMAT_UNDEFINED;
+  VkSampler sampler;
+  VkDescriptorSetLayout build_set_layout;
+  // The sampled pyramid at binding 0
+  VkDescriptorSetLayout cull_set_layout;
+  VkPipelineLayout build_layout;
+  PipelineHandle build_pipeline;
+
+  Targets targets;
+
+  void init_format(BootstrapInfo &bootstrap) {
+    VkFormatFeatureFlags needed =
+        VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT |
+        VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+    for (VkFormat format : {VK_FORMAT_D32_SFLOAT, VK_FORMAT_X8_D24_UNORM_PACK32,
+                            VK_FORMAT_D16_UNORM}) {
+      VkFormatProperties properties = {};
+      bootstrap.instance_dispatch.getPhysicalDeviceFormatProperties(
+          bootstrap.physical_device, format, &properties);
+      if ((properties.optimalTilingFeatures & needed) == needed) {
+        depth_format = format;
+        return;
+      }
+    }
+    CHECK_REPORT_STR(false, "No depth format can be sampled");
+  }
+
+  void init_layouts(BootstrapInfo &bootstrap) {
+    VkSamplerCreateInfo sampler_info = {};
+    sampler_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    sampler_info.magFilter = VK_FILTER_NEAREST;
+    sampler_info.minFilter = VK_FILTER_NEAREST;
+    sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler_info.maxLod = VK_LOD_CLAMP_NONE;
+    CHECK_VK(bootstrap.dispatch.createSampler(&sampler_info, NULL, &sampler));
+
+    std::array<VkDescriptorSetLayoutBinding, 2> bindings = {};
+    bindings[0].binding = 0;
+    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    bindings[0].descriptorCount = 1;
+    bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    bindings[0].pImmutableSamplers = &sampler;
+    bindings[1].binding = 1;
+    bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    bindings[1].descriptorCount = 1;
+    bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    VkDescriptorSetLayoutCreateInfo layout_info = {};
+    layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layout_info.bindingCount = bindings.size();
+    layout_info.pBindings = bindings.data();
+    CHECK_VK(bootstrap.dispatch.createDescriptorSetLayout(&layout_info, NULL,
+                                                          &build_set_layout));
+
+    layout_info.bindingCount = 1;
+    CHECK_VK(bootstrap.dispatch.createDescriptorSetLayout(&layout_info, NULL,
+                                                          &cull_set_layout));
+  }
+
+  void init_pipeline(BootstrapInfo &bootstrap, PipelineCompiler &pipelines) {
+    VkPushConstantRange push_range = {};
+    push_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    push_range.size = sizeof(HiZPushConstants);
+
+    VkPipelineLayoutCreateInfo layout_info = {};
+    layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    layout_info.setLayoutCount = 1;
+    layout_info.pSetLayouts = &build_set_layout;
+    layout_info.pushConstantRangeCount = 1;
+    layout_info.pPushConstantRanges = &push_range;
+    CHECK_VK(bootstrap.dispatch.createPipelineLayout(&layout_info, NULL,
+                                                     &build_layout));
+
+    ComputePipelineDesc desc;
+    desc.name = "hiz";
+    desc.comp_shader = "hiz.comp";
+    desc.layout = build_layout;
+    build_pipeline = pipelines.compile(bootstrap, desc);
+  }
+
+  static VkImageView create_view(BootstrapInfo &bootstrap, VkImage image,
+                                 VkFormat format, VkImageAspectFlags aspect,
+                                 uint32_t base_level, uint32_t level_count) {
+    VkImageViewCreateInfo view_info = {};
+    view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    view_info.image = image;
+    view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    view_info.format = format;
+    view_info.subresourceRange.aspectMask = aspect;
+    view_info.subresourceRange.baseMipLevel = base_level;
+    view_info.subresourceRange.levelCount = level_count;
+    view_info.subresourceRange.layerCount = 1;
+
+    VkImageView view;
+    CHECK_VK(bootstrap.dispatch.createImageView(&view_info, NULL, &view));
+    return view;
+  }
+
+  static uint32_t previous_power_of_two(uint32_t value) {
+    uint32_t power = 1;
+    while (power * 2 <= value)
+      power *= 2;
+    return power;
+  }
+
+  void create_images(BootstrapInfo &bootstrap, Targets &new_targets) {
+    VkExtent2D extent = bootstrap.extent();
+    new_targets.depth_extent = extent;
+    new_targets.extent = {previous_power_of_two(extent.width),
+                          previous_power_of_two(extent.height)};
+    new_targets.levels = 1;
+    while ((std::max(new_targets.extent.width, new_targets.extent.height) >>
+            new_targets.levels) > 0)
+      new_targets.levels++;
+
+    VkImageCreateInfo image_info = {};
+    image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    image_info.imageType = VK_IMAGE_TYPE_2D;
+    image_info.format = depth_format;
+    image_info.extent = {extent.width, extent.height, 1};
+    image_info.mipLevels = 1;
+    image_info.arrayLayers = 1;
+    image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+    image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    image_info.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+                       VK_IMAGE_USAGE_SAMPLED_BIT;
+    image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    VmaAllocationCreateInfo vmalloc_info = {};
+    vmalloc_info.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+    CHECK_VK(vmaCreateImage(bootstrap.allocator, &image_info, &vmalloc_info,
+                            &new_targets.depth, &new_targets.depth_allocation,
+                            nullptr));
+    new_targets.depth_view =
+        create_view(bootstrap, new_targets.depth, depth_format,
+                    VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1);
+
+    image_info.format = VK_FORMAT_R32_SFLOAT;
+    image_info.extent = {new_targets.extent.width, new_targets.extent.height,
+                         1};
+    image_info.mipLevels = new_targets.levels;
+    image_info.usage =
+        VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    CHECK_VK(vmaCreateImage(bootstrap.allocator, &image_info, &vmalloc_info,
+                            &new_targets.pyramid,
+                            &new_targets.pyramid_allocation, nullptr));
+    new_targets.pyramid_view =
+        create_view(bootstrap, new_targets.pyramid, VK_FORMAT_R32_SFLOAT,
+                    VK_IMAGE_ASPECT_COLOR_BIT, 0, new_targets.levels);
+    for (uint32_t level = 0; level < new_targets.levels; level++)
+      new_targets.level_views.push_back(
+          create_view(bootstrap, new_targets.pyramid, VK_FORMAT_R32_SFLOAT,
+                      VK_IMAGE_ASPECT_COLOR_BIT, level, 1));
+  }
+
+  void create_descriptors(BootstrapInfo &bootstrap, Targets &new_targets) {
+    uint32_t levels = new_targets.levels;
+    std::array<VkDescriptorPoolSize, 2> pool_sizes = {
+        VkDescriptorPoolSize{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                             levels + 1},
+        VkDescriptorPoolSize{VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, levels},
+    };
+    VkDescriptorPoolCreateInfo pool_info = {};
+    pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    pool_info.maxSets = levels + 1;
+    pool_info.poolSizeCount = pool_sizes.size();
+    pool_info.pPoolSizes = pool_sizes.data();
+    CHECK_VK(bootstrap.dispatch.createDescriptorPool(
+        &pool_info, NULL, &new_targets.descriptor_pool));
+
+    std::vector<VkDescriptorSetLayout> set_layouts(levels, build_set_layout);
+    set_layouts.push_back(cull_set_layout);
+    std::vector<VkDescriptorSet> sets(set_layouts.size());
+
+    VkDescriptorSetAllocateInfo set_info = {};
+    set_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    set_info.descriptorPool = new_targets.descriptor_pool;
+    set_info.descriptorSetCount = set_layouts.size();
+    set_info.pSetLayouts = set_layouts.data();
+    CHECK_VK(bootstrap.dispatch.allocateDescriptorSets(&set_info, sets.data()));
+    new_targets.build_sets.assign(sets.begin(), sets.begin() + levels);
+    new_targets.cull_set = sets.back();
+
+    // Image infos are written up front, the writes point into them
+    std::vector<VkDescriptorImageInfo> image_infos;
+    image_infos.reserve(levels * 2 + 1);
+    std::vector<VkWriteDescriptorSet> writes;
+
+    auto write = [&](VkDescriptorSet set, uint32_t binding,
+                     VkDescriptorType type, VkImageView view,
+                     VkImageLayout layout) {
+      image_infos.push_back({VK_NULL_HANDLE, view, layout});
+      VkWriteDescriptorSet descriptor_write = {};
+      descriptor_write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      descriptor_write.dstSet = set;
+      descriptor_write.dstBinding = binding;
+      descriptor_write.descriptorCount = 1;
+      descriptor_write.descriptorType = type;
+      descriptor_write.pImageInfo = &image_infos.back();
+      writes.push_back(descriptor_write);
+    };
+
+    for (uint32_t level = 0; level < levels; level++) {
+      if (level == 0)
+        write(new_targets.build_sets[level], 0,
+              VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, new_targets.depth_view,
+              VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+      else
+        write(new_targets.build_sets[level], 0,
+              VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+              new_targets.level_views[level - 1], VK_IMAGE_LAYOUT_GENERAL);
+      write(new_targets.build_sets[level], 1,
+            VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, new_targets.level_views[level],
+            VK_IMAGE_LAYOUT_GENERAL);
+    }
+    write(new_targets.cull_set, 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+          new_targets.pyramid_view, VK_IMAGE_LAYOUT_GENERAL);
+
+    bootstrap.dispatch.updateDescriptorSets(writes.size(), writes.data(), 0,
+                                            nullptr);
+  }
+
+  void create_targets(BootstrapInfo &bootstrap) {
+    Targets new_targets;
+    create_images(bootstrap, new_targets);
+    create_descriptors(bootstrap, new_targets);
+    targets = std::move(new_targets);
+  }
+
+  void init(BootstrapInfo &bootstrap, PipelineCompiler &pipelines) {
+    init_format(bootstrap);
+    init_layouts(bootstrap);
+    init_pipeline(bootstrap, pipelines);
+    create_targets(bootstrap);
+  }
+
+  // After the swapchain was replaced, frames in flight keep the old targets
+  void recreate(BootstrapInfo &bootstrap) {
+    Targets old_targets = std::move(targets);
+    bootstrap.deletion_queue.push([&bootstrap, old_targets]() {
+      bootstrap.dispatch.destroyDescriptorPool(old_targets.descriptor_pool,
+                                               nullptr);
+      for (auto view : old_targets.level_views)
+        bootstrap.dispatch.destroyImageView(view, nullptr);
+      bootstrap.dispatch.destroyImageView(old_targets.pyramid_view, nullptr);
+      bootstrap.dispatch.destroyImageView(old_targets.depth_view, nullptr);
+      vmaDestroyImage(bootstrap.allocator, old_targets.pyramid,
+                      old_targets.pyramid_allocation);
+      vmaDestroyImage(bootstrap.allocator, old_targets.depth,
+                      old_targets.depth_allocation);
+    });
+    create_targets(bootstrap);
+  }
+
+  bool is_ready(const PipelineCompiler &pipelines) const {
+    return pipelines.is_ready(build_pipeline);
+  }
+
+  // The culling pass binds the pyramid whether it tests against it or not,
+  // so it has to be in GENERAL before it is ever built
+  void cmd_initialize(BootstrapInfo &bootstrap,
+                      VkCommandBuffer command_buffer) {
+    if (targets.initialized)
+      return;
+
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = targets.pyramid;
+    barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, targets.levels,
+                                0, 1};
+    bootstrap.dispatch.cmdPipelineBarrier(
+        command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1,
+        &barrier);
+    targets.initialized = true;
+  }
+
+  // Has to be recorded outside of a render pass, after the depth was
+  // written. Leaves the pyramid readable by compute shaders.
+  void cmd_build(BootstrapInfo &bootstrap, PipelineCompiler &pipelines,
+                 VkCommandBuffer command_buffer) {
+    // Every level is rewritten, the previous frame may still be sampling
+    VkImageMemoryBarrier discard = {};
+    discard.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    discard.srcAccessMask = 0;
+    discard.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    discard.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    discard.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    discard.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    discard.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    discard.image = targets.pyramid;
+    discard.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, targets.levels,
+                                0, 1};
+    bootstrap.dispatch.cmdPipelineBarrier(
+        command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1,
+        &discard);
+
+    bootstrap.dispatch.cmdBindPipeline(command_buffer,
+                                       VK_PIPELINE_BIND_POINT_COMPUTE,
+                                       pipelines.get(build_pipeline));
+
+    glm::ivec2 src_size = {targets.depth_extent.width,
+                           targets.depth_extent.height};
+    for (uint32_t level = 0; level < targets.levels; level++) {
+      glm::ivec2 dst_size = {std::max(1u, targets.extent.width >> level),
+                             std::max(1u, targets.extent.height >> level)};
+      HiZPushConstants push = {src_size, dst_size};
+
+      bootstrap.dispatch.cmdBindDescriptorSets(
+          command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, build_layout, 0, 1,
+          &targets.build_sets[level], 0, nullptr);
+      bootstrap.dispatch.cmdPushConstants(command_buffer, build_layout,
+                                          VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                                          sizeof(push), &push);
+      bootstrap.dispatch.cmdDispatch(command_buffer, (dst_size.x + 7) / 8,
+                                     (dst_size.y + 7) / 8, 1);
+
+      // The next level, or the culling pass, reads this one
+      VkMemoryBarrier level_barrier = {};
+      level_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+      level_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+      level_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+      bootstrap.dispatch.cmdPipelineBarrier(
+          command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+          VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &level_barrier, 0,
+          nullptr, 0, nullptr);
+
+      src_size = dst_size;
+    }
+  }
+};
+
+} // namespace b::engine
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <array>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <vulkan/vulkan.h>
+
+#include "arena.hpp"
+#include "bootstrap.hpp"
+#include "vertex_layout.hpp"
+
+namespace b::engine {
+
+// Per-instance attributes, streamed through binding 1 right after the vertex
+// attributes. Matches the inputs of instanced.vert.
+struct Instance {
+  glm::vec2 translation = {0.0f, 0.0f};
+  // Negative scales flip the winding and get the instance culled
+  glm::vec2 scale = {1.0f, 1.0f};
+  // Radians, applied after the scale
+  float rotation = 0.0f;
+  // RGBA8 multiplied with the vertex color, 0xAABBGGRR
+  uint32_t color = 0xffffffff;
+  // Free for custom pipelines, ignored by instanced.vert
+  glm::vec2 custom = {0.0f, 0.0f};
+
+  static constexpr std::array<VertexAttribute, 5> attributes() {
+    return {VERTEX_ATTRIBUTE(Instance, translation),
+            VERTEX_ATTRIBUTE(Instance, scale),
+            VERTEX_ATTRIBUTE(Instance, rotation),
+            VERTEX_ATTRIBUTE_AS(Instance, color, VK_FORMAT_R8G8B8A8_UNORM),
+            VERTEX_ATTRIBUTE(Instance, custom)};
+  }
+};
+
+// Instances pushed for the frame being built, written straight into a
+// persistently mapped buffer owned by the frame in flight. Consecutive pushes
+// of the same mesh extend the same batch, and every batch is a single
+// instanced draw.
+struct InstanceBuffer {
+  struct Frame {
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VmaAllocation allocation = VK_NULL_HANDLE;
+    Instance *mapped = nullptr;
+    uint32_t count = 0;
+  };
+
+  struct Batch {
+    Mesh mesh;
+    uint32_t first_instance;
+    uint32_t instance_count;
+  };
+
+  // Instances per frame, has to be set before init
+  uint32_t capacity = 1 << 16;
+
+  std::vector<Frame> frames;
+  uint32_t current = 0;
+  std::vector<Batch> batches;
+
+  void init(BootstrapInfo &bootstrap, uint32_t frames_in_flight) {
+    frames.resize(frames_in_flight);
+
+    VkBufferCreateInfo buffer_info = {};
+    buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_info.size = sizeof(Instance) * capacity;
+    buffer_info.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+    buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    // Device local if the device exposes it to the host, read once per frame
+    // by the GPU either way
+    VmaAllocationCreateInfo vmalloc_info = {};
+    vmalloc_info.usage = VMA_MEMORY_USAGE_AUTO;
+    vmalloc_info.flags =
+        VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
+        VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+    for (auto &frame : frames) {
+      VmaAllocationInfo allocation_info = {};
+      CHECK_VK(vmaCreateBuffer(bootstrap.allocator, &buffer_info,
+                               &vmalloc_info, &frame.buffer, &frame.allocation,
+                               &allocation_info));
+      frame.mapped = (Instance *)allocation_info.pMappedData;
+      CHECK(frame.mapped);
+    }
+  }
+
+  // The fence of the frame must have been waited on
+  void begin_frame(uint32_t frame) {
+    current = frame;
+    frames[current].count = 0;
+    batches.clear();
+  }
+
+  static bool same_mesh(const Mesh &a, const Mesh &b) {
+    return a.vert_buffer == b.vert_buffer && a.first_index == b.first_index &&
+           a.index_count == b.index_count &&
+           a.index_type == b.index_type && a.vertex_offset == b.vertex_offset;
+  }
+
+  // Room for `count` instances of the mesh to be filled in before the frame
+  // is drawn. The memory is write-combined, write it sequentially and never
+  // read it back.
+  Instance *push(const Mesh &mesh, uint32_t count) {
+    Frame &frame = frames[current];
+    CHECK_REPORT_FMT(frame.count + count <= capacity,
+                     "The instance buffer holds {} instances per frame",
+                     capacity);
+
+    if (batches.empty() || !same_mesh(batches.back().mesh, mesh))
+      batches.push_back({mesh, frame.count, 0});
+    batches.back().instance_count += count;
+
+    Instance *instances = frame.mapped + frame.count;
+    frame.count += count;
+    return instances;
+  }
+
+  void push(const Mesh &mesh, const Instance &instance) {
+    *push(mesh, 1) = instance;
+  }
+
+  // Makes the writes visible to the device, a no-op on coherent memory
+  void flush(BootstrapInfo &bootstrap) {
+    Frame &frame = frames[current];
+    if (frame.count > 0)
+      CHECK_VK(vmaFlushAllocation(bootstrap.allocator, frame.allocation, 0,
+                                  sizeof(Instance) * frame.count));
+  }
+
+  // Draws [begin, end) of the batches, the instanced pipeline has to be bound
+  void cmd_draw(BootstrapInfo &bootstrap, VkCommandBuffer command_buffer,
+                uint32_t begin, uint32_t end) {
+    VkBuffer instance_buffer = frames[current].buffer;
+    VkBuffer bound_vert_buffer = VK_NULL_HANDLE;
+    VkIndexType bound_index_type = VK_INDEX_TYPE_MAX_ENUM;
+
+    for (uint32_t i = begin; i < end; i++) {
+      const Batch &batch = batches[i];
+
+      // Meshes sharing an arena page and index type share the binds
+      if (batch.mesh.vert_buffer != bound_vert_buffer) {
+        VkBuffer vertex_buffers[] = {batch.mesh.vert_buffer, instance_buffer};
+        VkDeviceSize offsets[] = {0, 0};
+        bootstrap.dispatch.cmdBindVertexBuffers(command_buffer, 0, 2,
+                                                vertex_buffers, offsets);
+        bound_vert_buffer = batch.mesh.vert_buffer;
+        bound_index_type = VK_INDEX_TYPE_MAX_ENUM;
+      }
+      if (batch.mesh.index_type != bound_index_type) {
+        bootstrap.dispatch.cmdBindIndexBuffer(command_buffer,
+                                              batch.mesh.index_buffer, 0,
+                                              batch.mesh.index_type);
+        bound_index_type = batch.mesh.index_type;
+      }
+
+      bootstrap.dispatch.cmdDrawIndexed(
+          command_buffer, batch.mesh.index_count, batch.instance_count,
+          batch.mesh.first_index, batch.mesh.vertex_offset,
+          batch.first_instance);
+    }
+  }
+};
+
+} // namespace b::engine
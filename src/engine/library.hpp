@@ -1,57 +1,148 @@
 #pragma once
 
+#include <functional>
+#include <string>
 #include <vector>
 #include <vulkan/vulkan.h>
 
+#include "arena.hpp"
 #include "bootstrap.hpp"
+#include "memory_budget.hpp"
+#include "mesh_file.hpp"
+#include "mesh_optimizer.hpp"
+#include "upload.hpp"
 #include "vertex.hpp"
 
 namespace b::engine {
 
-struct Mesh {
-  VkBuffer vert_buffer;
-  VmaAllocation vert_allocation;
-  VkBuffer index_buffer;
-  VmaAllocation index_allocation;
-};
-
 struct Library {
-  Mesh add_mesh(BootstrapInfo &bootstrap, std::vector<Vertex> vertices,
-                std::vector<uint32_t> indices) {
+  Uploader uploader;
+  GeometryArena arena;
+
+  // Deduplicate, reorder and narrow the indices of added meshes
+  bool optimize_meshes = false;
+
+  // Consulted whenever a mesh needs a new arena page, the only point at
+  // which adding meshes allocates device memory
+  BudgetPolicy budget_policy = default_budget_policy;
+  // Called for BudgetDecision::EVICT with the bytes needed, typically
+  // removing meshes that were not drawn lately. The policy is then asked
+  // again with the budget at that point. The memory only comes back once the
+  // deferred destructions have run, so that is usually a downgrade.
+  std::function<void(VkDeviceSize)> evict;
+
+  void init(BootstrapInfo &bootstrap) {
+    uploader.init(bootstrap);
+    arena.init(sizeof(PackedVertex));
+  }
+
+  // Places the mesh in the arena, asking the budget policy before a new page
+  // is allocated. Returns an invalid mesh if the policy refused.
+  Mesh allocate_mesh(BootstrapInfo &bootstrap, uint32_t vertex_count,
+                     uint32_t index_count, VkIndexType index_type) {
     Mesh mesh = {};
+    if (arena.try_allocate(vertex_count, index_count, index_type, mesh))
+      return mesh;
+
+    BudgetRequest request = {};
+    request.heap = uploader.device_buffer_heap(
+        bootstrap, arena.vertex_stride, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+    request.bytes =
+        arena.page_bytes(vertex_count, index_count, index_type, false);
+    request.min_bytes =
+        arena.page_bytes(vertex_count, index_count, index_type, true);
+    request.budget = heap_budget(bootstrap, request.heap);
+    request.can_evict = (bool)evict;
+
+    // A policy asking to evict twice is refused
+    BudgetDecision decision = budget_policy(request);
+    if (decision == BudgetDecision::EVICT && evict) {
+      evict(request.bytes);
+      request.budget = heap_budget(bootstrap, request.heap);
+      request.can_evict = false;
+      decision = budget_policy(request);
+    }
+
+    if (decision == BudgetDecision::REFUSE ||
+        decision == BudgetDecision::EVICT) {
+      spdlog::warn("Refused a mesh of {} vertices: heap {} uses {} of {} "
+                   "budgeted bytes",
+                   vertex_count, request.heap, request.budget.usage,
+                   request.budget.budget);
+      return {};
+    }
+
+    return arena.allocate_in_new_page(bootstrap, uploader, vertex_count,
+                                      index_count, index_type,
+                                      decision == BudgetDecision::DOWNGRADE);
+  }
 
-    VkBufferCreateInfo vert_buffer_info = {};
-    vert_buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    vert_buffer_info.size = vertices.size() * sizeof(Vertex);
-    vert_buffer_info.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
-    vert_buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-
-    VmaAllocationCreateInfo vmalloc_info = {};
-    vmalloc_info.usage = VMA_MEMORY_USAGE_AUTO;
-    vmalloc_info.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
-
-    CHECK_VK(vmaCreateBuffer(bootstrap.allocator, &vert_buffer_info,
-                             &vmalloc_info, &mesh.vert_buffer,
-                             &mesh.vert_allocation, nullptr));
-    CHECK_VK(vmaCopyMemoryToAllocation(bootstrap.allocator, vertices.data(),
-                                       mesh.vert_allocation, 0,
-                                       sizeof(Vertex) * vertices.size()));
-
-    VkBufferCreateInfo index_buffer_info = {};
-    index_buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    index_buffer_info.size = sizeof(uint32_t) * indices.size();
-    index_buffer_info.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
-    index_buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-
-    CHECK_VK(vmaCreateBuffer(bootstrap.allocator, &index_buffer_info,
-                             &vmalloc_info, &mesh.index_buffer,
-                             &mesh.index_allocation, nullptr));
-    CHECK_VK(vmaCopyMemoryToAllocation(bootstrap.allocator, indices.data(),
-                                       mesh.index_allocation, 0,
-                                       sizeof(uint32_t) * indices.size()));
+  // Mesh ranges are only valid to draw from after the uploads are flushed.
+  // Vertices are packed to PackedVertex on the way. Returns an invalid mesh
+  // if the budget policy refused it.
+  Mesh add_mesh(BootstrapInfo &bootstrap, const std::vector<Vertex> &vertices,
+                std::vector<uint32_t> indices) {
+    std::vector<PackedVertex> packed(vertices.size());
+    pack_vertices(vertices.data(), packed.data(), vertices.size());
+
+    VkIndexType index_type = VK_INDEX_TYPE_UINT32;
+    const void *index_data = indices.data();
+    std::vector<uint16_t> narrow_indices;
+
+    if (optimize_meshes) {
+      // Deduplication runs on the packed vertices, which also merges the ones
+      // that only differed below the packed precision
+      optimize_mesh(packed, indices).log();
+
+      if (fits_uint16_indices(packed.size())) {
+        narrow_indices.assign(indices.begin(), indices.end());
+        index_type = VK_INDEX_TYPE_UINT16;
+        index_data = narrow_indices.data();
+      }
+    }
 
+    Mesh mesh = allocate_mesh(bootstrap, packed.size(), indices.size(),
+                              index_type);
+    if (mesh.valid())
+      arena.upload(bootstrap, uploader, mesh, packed.data(), index_data);
     return mesh;
   }
+
+  // Maps a file written by sbox-mesh-convert, the sections are copied from
+  // the mapping straight into staging memory or a host visible arena page.
+  // Returns an invalid mesh if the budget policy refused it.
+  Mesh load_mesh(BootstrapInfo &bootstrap, const std::string &path,
+                 MeshBounds *bounds = nullptr) {
+    MappedMeshFile file;
+    CHECK_REPORT_FMT(file.open(path), "Failed to load the mesh {}", path);
+
+    const MeshFileHeader &header = *file.header;
+    Mesh mesh = allocate_mesh(bootstrap, header.vertex_count,
+                              header.index_count,
+                              (VkIndexType)header.index_type);
+    if (mesh.valid())
+      arena.upload(bootstrap, uploader, mesh, file.vertices(),
+                   file.indices());
+
+    if (bounds)
+      *bounds = header.bounds;
+    return mesh;
+  }
+
+  // The mesh must not be drawn from frames built after this. Its range is
+  // freed once the frames that may draw it and its upload have completed,
+  // pending uploads are flushed for that.
+  void remove_mesh(BootstrapInfo &bootstrap, const Mesh &mesh) {
+    if (!mesh.valid())
+      return;
+    bootstrap.deletion_queue.push(
+        [this, &bootstrap, mesh]() { arena.free(bootstrap, mesh); },
+        uploader.flush(bootstrap));
+  }
+
+  SubmitTicket flush_uploads(BootstrapInfo &bootstrap) {
+    return uploader.flush(bootstrap);
+  }
 };
 
 } // namespace b::engine
@@ -0,0 +1,204 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <imgui/imgui.h>
+#include <spdlog/fmt/fmt.h>
+#include <spdlog/spdlog.h>
+#include <vulkan/vulkan.h>
+
+#include "bootstrap.hpp"
+
+namespace b::engine {
+
+// Current usage and budget of a heap, cheap enough to query per allocation
+inline VmaBudget heap_budget(BootstrapInfo &bootstrap, uint32_t heap) {
+  std::array<VmaBudget, VK_MAX_MEMORY_HEAPS> budgets = {};
+  vmaGetHeapBudgets(bootstrap.allocator, budgets.data());
+  return budgets[heap];
+}
+
+enum class BudgetDecision {
+  ALLOW,
+  // Allocate only what the request needs, no headroom for later ones
+  DOWNGRADE,
+  // Free something first, see Library::evict
+  EVICT,
+  REFUSE,
+};
+
+struct BudgetRequest {
+  uint32_t heap;
+  // What would be allocated, and the least that would do
+  VkDeviceSize bytes;
+  VkDeviceSize min_bytes;
+  VmaBudget budget;
+  // Whether EVICT can be answered, false once the eviction already ran
+  bool can_evict = false;
+};
+
+using BudgetPolicy = std::function<BudgetDecision(const BudgetRequest &)>;
+
+// Full allocations below 80% of the budget, minimal ones below 95%. In
+// between eviction is asked for first when it can be.
+inline BudgetDecision default_budget_policy(const BudgetRequest &request) {
+  VkDeviceSize usage = request.budget.usage;
+  VkDeviceSize budget = request.budget.budget;
+  if (usage + request.bytes <= budget / 10 * 8)
+    return BudgetDecision::ALLOW;
+  if (usage + request.min_bytes <= budget / 20 * 19)
+    return request.can_evict ? BudgetDecision::EVICT
+                             : BudgetDecision::DOWNGRADE;
+  return BudgetDecision::REFUSE;
+}
+
+struct HeapStats {
+  VkMemoryHeapFlags flags = 0;
+  VkDeviceSize size = 0;
+  VmaBudget budget = {};
+
+  // From the last full statistics, which walk every block
+  uint32_t unused_range_count = 0;
+  VkDeviceSize largest_unused_range = 0;
+  // Share of the unused bytes in blocks that is not in the largest range
+  float fragmentation = 0.0f;
+};
+
+// Per-heap usage against the budget reported by VK_EXT_memory_budget. Budgets
+// are read every frame, the full statistics and the JSON dump periodically
+// since they lock and walk the allocator.
+struct MemoryTelemetry {
+  using clock = std::chrono::steady_clock;
+
+  std::vector<HeapStats> heaps;
+
+  double statistics_interval_s = 0.5;
+  clock::time_point last_statistics;
+
+  // Written every dump_interval_s when set
+  const char *dump_path = nullptr;
+  double dump_interval_s = 5.0;
+  clock::time_point last_dump;
+
+  void init(BootstrapInfo &bootstrap) {
+    const VkPhysicalDeviceMemoryProperties *properties = nullptr;
+    vmaGetMemoryProperties(bootstrap.allocator, &properties);
+
+    heaps.resize(properties->memoryHeapCount);
+    for (uint32_t i = 0; i < heaps.size(); i++) {
+      heaps[i].flags = properties->memoryHeaps[i].flags;
+      heaps[i].size = properties->memoryHeaps[i].size;
+    }
+
+    update_statistics(bootstrap);
+  }
+
+  void update_statistics(BootstrapInfo &bootstrap) {
+    VmaTotalStatistics statistics = {};
+    vmaCalculateStatistics(bootstrap.allocator, &statistics);
+
+    for (uint32_t i = 0; i < heaps.size(); i++) {
+      const VmaDetailedStatistics &heap = statistics.memoryHeap[i];
+      VkDeviceSize unused =
+          heap.statistics.blockBytes - heap.statistics.allocationBytes;
+
+      heaps[i].unused_range_count = heap.unusedRangeCount;
+      heaps[i].largest_unused_range =
+          heap.unusedRangeCount > 0 ? heap.unusedRangeSizeMax : 0;
+      heaps[i].fragmentation =
+          unused > 0 ? 1.0f - (float)heaps[i].largest_unused_range / unused
+                     : 0.0f;
+    }
+    last_statistics = clock::now();
+  }
+
+  // Once per frame, after vmaSetCurrentFrameIndex refreshed the budgets
+  void update(BootstrapInfo &bootstrap) {
+    std::array<VmaBudget, VK_MAX_MEMORY_HEAPS> budgets = {};
+    vmaGetHeapBudgets(bootstrap.allocator, budgets.data());
+    for (uint32_t i = 0; i < heaps.size(); i++)
+      heaps[i].budget = budgets[i];
+
+    auto now = clock::now();
+    if (std::chrono::duration<double>(now - last_statistics).count() >=
+        statistics_interval_s)
+      update_statistics(bootstrap);
+
+    if (dump_path && std::chrono::duration<double>(now - last_dump).count() >=
+                         dump_interval_s) {
+      dump(dump_path);
+      last_dump = now;
+    }
+  }
+
+  std::string to_json() const {
+    std::string json = "{\"heaps\":[";
+    for (size_t i = 0; i < heaps.size(); i++) {
+      const HeapStats &heap = heaps[i];
+      json += fmt::format(
+          "{}{{\"heap\":{},\"device_local\":{},\"size\":{},\"usage\":{},"
+          "\"budget\":{},\"block_count\":{},\"block_bytes\":{},"
+          "\"allocation_count\":{},\"allocation_bytes\":{},"
+          "\"unused_range_count\":{},\"largest_unused_range\":{},"
+          "\"fragmentation\":{:.4f}}}",
+          i > 0 ? "," : "", i,
+          (heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0, heap.size,
+          heap.budget.usage, heap.budget.budget,
+          heap.budget.statistics.blockCount,
+          heap.budget.statistics.blockBytes,
+          heap.budget.statistics.allocationCount,
+          heap.budget.statistics.allocationBytes, heap.unused_range_count,
+          heap.largest_unused_range, heap.fragmentation);
+    }
+    json += "]}\n";
+    return json;
+  }
+
+  // Written next to the target and renamed, readers polling the file never
+  // see a partial dump
+  void dump(const char *path) const {
+    std::string tmp_path = std::string(path) + ".tmp";
+    {
+      std::ofstream file(tmp_path, std::ios::trunc);
+      if (!(file << to_json())) {
+        spdlog::warn("Failed to write the memory dump {}", tmp_path);
+        return;
+      }
+    }
+    if (std::rename(tmp_path.c_str(), path) != 0)
+      spdlog::warn("Failed to write the memory dump {}", path);
+  }
+
+  void draw_imgui() {
+    ImGui::Begin("Memory");
+
+    for (uint32_t i = 0; i < heaps.size(); i++) {
+      const HeapStats &heap = heaps[i];
+      float usage_mb = heap.budget.usage / (1024.0f * 1024.0f);
+      float budget_mb = heap.budget.budget / (1024.0f * 1024.0f);
+
+      ImGui::Text("Heap %u%s, %.0f MB", i,
+                  heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT
+                      ? " (device local)"
+                      : "",
+                  heap.size / (1024.0f * 1024.0f));
+      auto overlay = fmt::format("{:.1f} / {:.1f} MB", usage_mb, budget_mb);
+      ImGui::ProgressBar(budget_mb > 0.0f ? usage_mb / budget_mb : 0.0f,
+                         ImVec2(-1.0f, 0.0f), overlay.c_str());
+      ImGui::Text("%u blocks, %u allocations, %.1f%% fragmented",
+                  heap.budget.statistics.blockCount,
+                  heap.budget.statistics.allocationCount,
+                  heap.fragmentation * 100.0f);
+    }
+
+    ImGui::End();
+  }
+};
+
+} // namespace b::engine
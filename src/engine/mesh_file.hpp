@@ -0,0 +1,258 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <glm/glm.hpp>
+#include <spdlog/spdlog.h>
+#include <vulkan/vulkan.h>
+
+#include "mesh_optimizer.hpp"
+#include "vertex.hpp"
+
+namespace b::engine {
+
+// Binary mesh container, written by sbox-mesh-convert and mapped at load
+// time. The header is followed by the vertex and index sections, each
+// aligned to MESH_FILE_ALIGNMENT and stored exactly as the arena expects
+// them, so loading is a copy from the mapping into staging memory.
+constexpr uint32_t MESH_FILE_MAGIC = 0x4d584253; // "SBXM"
+// Bumped whenever the header or the vertex packing changes
+constexpr uint32_t MESH_FILE_VERSION = 1;
+constexpr uint64_t MESH_FILE_ALIGNMENT = 64;
+constexpr uint32_t MESH_FILE_MAX_ATTRIBUTES = 8;
+
+struct MeshBounds {
+  glm::vec3 min = glm::vec3(0.0f);
+  glm::vec3 max = glm::vec3(0.0f);
+  // Bounding sphere, w is the radius
+  glm::vec4 sphere = glm::vec4(0.0f);
+};
+
+struct MeshFileHeader {
+  uint32_t magic;
+  uint32_t version;
+
+  // Vertex layout the sections were packed with, checked against
+  // PackedVertex on load
+  uint32_t vertex_stride;
+  uint32_t attribute_count;
+  VertexAttribute attributes[MESH_FILE_MAX_ATTRIBUTES];
+
+  uint32_t index_type;
+  uint32_t vertex_count;
+  uint32_t index_count;
+  uint32_t reserved;
+
+  uint64_t vertex_offset;
+  uint64_t vertex_size;
+  uint64_t index_offset;
+  uint64_t index_size;
+
+  MeshBounds bounds;
+};
+// Any change to the header needs a version bump
+static_assert(sizeof(MeshFileHeader) == 168);
+
+inline void fill_mesh_file_layout(MeshFileHeader &header) {
+  constexpr auto attributes = PackedVertex::attributes();
+  static_assert(attributes.size() <= MESH_FILE_MAX_ATTRIBUTES);
+
+  header.vertex_stride = sizeof(PackedVertex);
+  header.attribute_count = attributes.size();
+  for (uint32_t i = 0; i < attributes.size(); i++)
+    header.attributes[i] = attributes[i];
+}
+
+inline MeshBounds compute_bounds(const std::vector<Vertex> &vertices) {
+  MeshBounds bounds;
+  if (vertices.empty())
+    return bounds;
+
+  bounds.min = bounds.max = glm::vec3(vertices[0].position, 0.0f);
+  for (auto &vertex : vertices) {
+    bounds.min = glm::min(bounds.min, glm::vec3(vertex.position, 0.0f));
+    bounds.max = glm::max(bounds.max, glm::vec3(vertex.position, 0.0f));
+  }
+
+  // Centered on the box, not the tightest sphere but cheap and stable
+  glm::vec3 center = (bounds.min + bounds.max) * 0.5f;
+  float radius = 0.0f;
+  for (auto &vertex : vertices)
+    radius = std::max(radius,
+                      glm::length(glm::vec3(vertex.position, 0.0f) - center));
+  bounds.sphere = glm::vec4(center, radius);
+  return bounds;
+}
+
+inline uint64_t align_mesh_file_offset(uint64_t offset) {
+  return (offset + MESH_FILE_ALIGNMENT - 1) & ~(MESH_FILE_ALIGNMENT - 1);
+}
+
+// Packs, optionally optimizes and writes the mesh. Returns false if the file
+// could not be written.
+inline bool write_mesh_file(const std::string &path,
+                            const std::vector<Vertex> &vertices,
+                            std::vector<uint32_t> indices, bool optimize) {
+  std::vector<PackedVertex> packed(vertices.size());
+  pack_vertices(vertices.data(), packed.data(), vertices.size());
+
+  if (optimize)
+    optimize_mesh(packed, indices).log();
+
+  bool narrow = optimize && fits_uint16_indices(packed.size());
+  std::vector<uint16_t> narrow_indices;
+  if (narrow)
+    narrow_indices.assign(indices.begin(), indices.end());
+
+  MeshFileHeader header = {};
+  header.magic = MESH_FILE_MAGIC;
+  header.version = MESH_FILE_VERSION;
+  fill_mesh_file_layout(header);
+  VkIndexType index_type = narrow ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+  header.index_type = index_type;
+  header.vertex_count = packed.size();
+  header.index_count = indices.size();
+  header.vertex_offset = align_mesh_file_offset(sizeof(header));
+  header.vertex_size = packed.size() * sizeof(PackedVertex);
+  header.index_offset =
+      align_mesh_file_offset(header.vertex_offset + header.vertex_size);
+  header.index_size = indices.size() * index_type_size(index_type);
+  header.bounds = compute_bounds(vertices);
+
+  const void *index_data =
+      narrow ? (const void *)narrow_indices.data() : indices.data();
+
+  // Written next to the target and renamed, a reader never maps a partial
+  // file
+  std::string tmp_path = path + ".tmp";
+  FILE *file = std::fopen(tmp_path.c_str(), "wb");
+  if (!file) {
+    spdlog::error("Failed to open {} for writing", tmp_path);
+    return false;
+  }
+
+  static const uint8_t padding[MESH_FILE_ALIGNMENT] = {};
+  auto write = [&](const void *data, size_t size) {
+    return size == 0 || std::fwrite(data, size, 1, file) == 1;
+  };
+
+  bool written =
+      write(&header, sizeof(header)) &&
+      write(padding, header.vertex_offset - sizeof(header)) &&
+      write(packed.data(), header.vertex_size) &&
+      write(padding,
+            header.index_offset - header.vertex_offset - header.vertex_size) &&
+      write(index_data, header.index_size);
+  written = std::fclose(file) == 0 && written;
+
+  if (!written || std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+    spdlog::error("Failed to write the mesh file {}", path);
+    std::remove(tmp_path.c_str());
+    return false;
+  }
+
+  spdlog::info("Wrote {}: {} vertices, {} {}-bit indices, {} bytes", path,
+               header.vertex_count, header.index_count, narrow ? 16 : 32,
+               header.index_offset + header.index_size);
+  return true;
+}
+
+// Read-only mapping of a mesh file, the sections point into the mapping and
+// are only valid while it is alive
+struct MappedMeshFile {
+  void *data = MAP_FAILED;
+  size_t size = 0;
+  const MeshFileHeader *header = nullptr;
+
+  MappedMeshFile() = default;
+  MappedMeshFile(const MappedMeshFile &) = delete;
+  MappedMeshFile &operator=(const MappedMeshFile &) = delete;
+
+  ~MappedMeshFile() {
+    if (data != MAP_FAILED)
+      munmap(data, size);
+  }
+
+  static bool is_compatible(const MeshFileHeader &header, size_t file_size) {
+    MeshFileHeader expected = {};
+    fill_mesh_file_layout(expected);
+
+    bool index_type_valid = header.index_type == VK_INDEX_TYPE_UINT16 ||
+                            header.index_type == VK_INDEX_TYPE_UINT32;
+    return header.magic == MESH_FILE_MAGIC &&
+           header.version == MESH_FILE_VERSION &&
+           header.vertex_stride == expected.vertex_stride &&
+           header.attribute_count == expected.attribute_count &&
+           std::memcmp(header.attributes, expected.attributes,
+                       sizeof(VertexAttribute) * expected.attribute_count) ==
+               0 &&
+           index_type_valid &&
+           header.vertex_size ==
+               (uint64_t)header.vertex_count * header.vertex_stride &&
+           header.index_size ==
+               (uint64_t)header.index_count *
+                   index_type_size((VkIndexType)header.index_type) &&
+           header.vertex_offset <= file_size &&
+           header.vertex_size <= file_size - header.vertex_offset &&
+           header.index_offset <= file_size &&
+           header.index_size <= file_size - header.index_offset;
+  }
+
+  // Returns false if the file is missing, truncated or was written for
+  // another vertex layout or format version
+  bool open(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      spdlog::error("Failed to open the mesh file {}", path);
+      return false;
+    }
+
+    struct stat file_stat = {};
+    if (fstat(fd, &file_stat) != 0 ||
+        (size_t)file_stat.st_size < sizeof(MeshFileHeader)) {
+      spdlog::error("The mesh file {} is truncated", path);
+      close(fd);
+      return false;
+    }
+
+    size = file_stat.st_size;
+    data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+      spdlog::error("Failed to map the mesh file {}", path);
+      return false;
+    }
+    // Both sections are read front to back exactly once
+    madvise(data, size, MADV_SEQUENTIAL);
+    madvise(data, size, MADV_WILLNEED);
+
+    header = (const MeshFileHeader *)data;
+    if (!is_compatible(*header, size)) {
+      spdlog::error("The mesh file {} is invalid or was written by another "
+                    "version",
+                    path);
+      return false;
+    }
+
+    return true;
+  }
+
+  const void *vertices() const {
+    return (const uint8_t *)data + header->vertex_offset;
+  }
+
+  const void *indices() const {
+    return (const uint8_t *)data + header->index_offset;
+  }
+};
+
+} // namespace b::engine
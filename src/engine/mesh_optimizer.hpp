@@ -0,0 +1,268 @@
+#pragma once
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+#include <vulkan/vulkan.h>
+
+namespace b::engine {
+
+struct MeshStats {
+  size_t vertex_count = 0;
+  size_t index_count = 0;
+  size_t bytes = 0;
+  // Average cache miss ratio, vertex shader invocations per triangle
+  float acmr = 0.0f;
+};
+
+struct MeshOptimizationStats {
+  MeshStats before;
+  MeshStats after;
+  double optimization_ms = 0.0;
+
+  void log() const {
+    spdlog::info("Optimized mesh in {:.2f} ms: {} -> {} vertices, ACMR "
+                 "{:.3f} -> {:.3f}, {} -> {} bytes",
+                 optimization_ms, before.vertex_count, after.vertex_count,
+                 before.acmr, after.acmr, before.bytes, after.bytes);
+  }
+};
+
+// Indices narrow to 16 bits when every vertex of the mesh is addressable
+inline bool fits_uint16_indices(size_t vertex_count) {
+  return vertex_count <= (1 << 16);
+}
+
+// FIFO cache simulation, close to what current GPUs do for post-transform
+// vertex reuse
+inline float simulate_acmr(const std::vector<uint32_t> &indices,
+                           size_t vertex_count, uint32_t cache_size = 16) {
+  if (indices.size() < 3)
+    return 0.0f;
+
+  // A vertex is cached if it was loaded less than `cache_size` misses ago
+  std::vector<uint32_t> loaded_at(vertex_count, 0);
+  uint32_t misses = 0;
+  uint32_t clock = cache_size + 1;
+  for (auto index : indices) {
+    if (clock - loaded_at[index] > cache_size) {
+      loaded_at[index] = clock++;
+      misses++;
+    }
+  }
+
+  return (float)misses / (indices.size() / 3);
+}
+
+template <typename V>
+MeshStats mesh_stats(const std::vector<V> &vertices,
+                     const std::vector<uint32_t> &indices,
+                     size_t index_size) {
+  MeshStats stats;
+  stats.vertex_count = vertices.size();
+  stats.index_count = indices.size();
+  stats.bytes = vertices.size() * sizeof(V) + indices.size() * index_size;
+  stats.acmr = simulate_acmr(indices, vertices.size());
+  return stats;
+}
+
+// Merges vertices with the same bytes, V must not have padding
+template <typename V>
+void deduplicate_vertices(std::vector<V> &vertices,
+                          std::vector<uint32_t> &indices) {
+  auto hash = [&](uint32_t i) {
+    // FNV-1a
+    const uint8_t *bytes = (const uint8_t *)&vertices[i];
+    size_t h = 14695981039346656037ull;
+    for (size_t b = 0; b < sizeof(V); b++)
+      h = (h ^ bytes[b]) * 1099511628211ull;
+    return h;
+  };
+  auto equal = [&](uint32_t a, uint32_t b) {
+    return std::memcmp(&vertices[a], &vertices[b], sizeof(V)) == 0;
+  };
+
+  std::unordered_map<uint32_t, uint32_t, decltype(hash), decltype(equal)>
+      unique(vertices.size(), hash, equal);
+  std::vector<uint32_t> remap(vertices.size());
+  for (uint32_t i = 0; i < vertices.size(); i++)
+    remap[i] = unique.try_emplace(i, unique.size()).first->second;
+
+  std::vector<V> deduplicated(unique.size());
+  for (uint32_t i = 0; i < vertices.size(); i++)
+    deduplicated[remap[i]] = vertices[i];
+
+  for (auto &index : indices)
+    index = remap[index];
+  vertices = std::move(deduplicated);
+}
+
+// Tom Forsyth's linear-speed vertex cache optimization, triangles are emitted
+// greedily by the score of their vertices in a simulated LRU cache
+inline void optimize_vertex_cache(std::vector<uint32_t> &indices,
+                                  size_t vertex_count) {
+  constexpr int CACHE_SIZE = 32;
+  size_t triangle_count = indices.size() / 3;
+
+  auto vertex_score = [](int cache_position, uint32_t remaining) {
+    if (remaining == 0)
+      return -1.0f;
+
+    float score = 0.0f;
+    if (cache_position >= 0) {
+      // The last triangle's vertices score the same to not favour any order
+      if (cache_position < 3)
+        score = 0.75f;
+      else
+        score = std::pow(1.0f - (cache_position - 3) / (CACHE_SIZE - 3.0f),
+                         1.5f);
+    }
+
+    // Vertices with few triangles left are worth finishing off
+    return score + 2.0f / std::sqrt((float)remaining);
+  };
+
+  // Triangles of every vertex, the live ones first
+  std::vector<uint32_t> remaining(vertex_count, 0);
+  for (auto index : indices)
+    remaining[index]++;
+
+  std::vector<uint32_t> offsets(vertex_count + 1, 0);
+  for (size_t v = 0; v < vertex_count; v++)
+    offsets[v + 1] = offsets[v] + remaining[v];
+
+  std::vector<uint32_t> adjacency(indices.size());
+  std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+  for (uint32_t t = 0; t < triangle_count; t++)
+    for (uint32_t k = 0; k < 3; k++)
+      adjacency[fill[indices[t * 3 + k]]++] = t;
+
+  std::vector<int> cache_position(vertex_count, -1);
+  std::vector<float> vertex_scores(vertex_count);
+  for (size_t v = 0; v < vertex_count; v++)
+    vertex_scores[v] = vertex_score(-1, remaining[v]);
+
+  auto triangle_score = [&](uint32_t t) {
+    return vertex_scores[indices[t * 3]] + vertex_scores[indices[t * 3 + 1]] +
+           vertex_scores[indices[t * 3 + 2]];
+  };
+
+  std::vector<float> triangle_scores(triangle_count);
+  for (uint32_t t = 0; t < triangle_count; t++)
+    triangle_scores[t] = triangle_score(t);
+
+  std::vector<bool> emitted(triangle_count, false);
+  std::vector<uint32_t> output;
+  output.reserve(triangle_count * 3);
+
+  std::vector<uint32_t> cache, next_cache;
+  size_t cursor = 0;
+  int64_t best = -1;
+
+  while (output.size() < triangle_count * 3) {
+    // Nothing in the cache has triangles left, restart from the first
+    // triangle not yet emitted
+    if (best < 0) {
+      while (emitted[cursor])
+        cursor++;
+      best = cursor;
+    }
+
+    uint32_t triangle = best;
+    const uint32_t *corners = &indices[triangle * 3];
+    emitted[triangle] = true;
+    output.insert(output.end(), corners, corners + 3);
+
+    next_cache.assign(corners, corners + 3);
+    for (auto v : cache)
+      if (v != corners[0] && v != corners[1] && v != corners[2])
+        next_cache.push_back(v);
+
+    for (uint32_t k = 0; k < 3; k++) {
+      uint32_t v = corners[k];
+      uint32_t *live = &adjacency[offsets[v]];
+      uint32_t last = --remaining[v];
+      for (uint32_t i = 0; i <= last; i++) {
+        if (live[i] == triangle) {
+          std::swap(live[i], live[last]);
+          break;
+        }
+      }
+    }
+
+    // Evicted vertices are rescored too, their triangles lost cache hits
+    for (uint32_t i = 0; i < next_cache.size(); i++) {
+      uint32_t v = next_cache[i];
+      cache_position[v] = i < CACHE_SIZE ? i : -1;
+      vertex_scores[v] = vertex_score(cache_position[v], remaining[v]);
+    }
+
+    best = -1;
+    float best_score = -1.0f;
+    for (auto v : next_cache) {
+      for (uint32_t i = 0; i < remaining[v]; i++) {
+        uint32_t t = adjacency[offsets[v] + i];
+        triangle_scores[t] = triangle_score(t);
+        if (cache_position[v] >= 0 && triangle_scores[t] > best_score) {
+          best = t;
+          best_score = triangle_scores[t];
+        }
+      }
+    }
+
+    if (next_cache.size() > CACHE_SIZE)
+      next_cache.resize(CACHE_SIZE);
+    std::swap(cache, next_cache);
+  }
+
+  indices = std::move(output);
+}
+
+// Orders vertices by first use, so vertex fetches walk the buffer linearly.
+// Vertices no index refers to are dropped.
+template <typename V>
+void optimize_vertex_fetch(std::vector<V> &vertices,
+                           std::vector<uint32_t> &indices) {
+  std::vector<uint32_t> remap(vertices.size(), UINT32_MAX);
+  std::vector<V> reordered;
+  reordered.reserve(vertices.size());
+
+  for (auto &index : indices) {
+    if (remap[index] == UINT32_MAX) {
+      remap[index] = reordered.size();
+      reordered.push_back(vertices[index]);
+    }
+    index = remap[index];
+  }
+
+  vertices = std::move(reordered);
+}
+
+// Deduplication, vertex cache and then vertex fetch optimization, in place.
+// The stats assume the indices get narrowed when they fit in 16 bits.
+template <typename V>
+MeshOptimizationStats optimize_mesh(std::vector<V> &vertices,
+                                    std::vector<uint32_t> &indices) {
+  MeshOptimizationStats stats;
+  stats.before = mesh_stats(vertices, indices, sizeof(uint32_t));
+  auto start = std::chrono::steady_clock::now();
+
+  deduplicate_vertices(vertices, indices);
+  optimize_vertex_cache(indices, vertices.size());
+  optimize_vertex_fetch(vertices, indices);
+
+  stats.optimization_ms = std::chrono::duration<double, std::milli>(
+                              std::chrono::steady_clock::now() - start)
+                              .count();
+  stats.after = mesh_stats(vertices, indices,
+                           fits_uint16_indices(vertices.size())
+                               ? sizeof(uint16_t)
+                               : sizeof(uint32_t));
+  return stats;
+}
+
+} // namespace b::engine
@@ -0,0 +1,336 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "bootstrap.hpp"
+#include "shaders.hpp"
+
+namespace b::engine {
+
+// Shaders are embedded at build time, an override in
+// bootstrap.shader_override_dir takes precedence
+VkShaderModule create_shader_module(BootstrapInfo &bootstrap,
+                                    const char *name) {
+  std::vector<uint32_t> override_storage;
+  ShaderCode code = {};
+  if (!bootstrap.shader_override_dir ||
+      !load_shader_override(bootstrap.shader_override_dir, name,
+                            override_storage, code))
+    code = find_embedded_shader(name);
+  CHECK_REPORT_FMT(code.code, "No shader named {} was embedded", name);
+
+  VkShaderModuleCreateInfo create_info = {};
+  create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+  create_info.codeSize = code.size;
+  create_info.pCode = code.code;
+
+  VkShaderModule shader;
+  CHECK_VK(bootstrap.dispatch.createShaderModule(&create_info, NULL, &shader));
+  return shader;
+}
+
+// Everything needed to build a graphics pipeline, owned by value so that it
+// can be compiled on another thread. Viewport and scissor are always dynamic.
+struct GraphicsPipelineDesc {
+  std::string name;
+  // Shader source file names, see shaders.hpp
+  std::string vert_shader;
+  std::string frag_shader;
+
+  std::vector<VkVertexInputBindingDescription> bindings;
+  std::vector<VkVertexInputAttributeDescription> attributes;
+
+  VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+  VkCullModeFlags cull_mode = VK_CULL_MODE_BACK_BIT;
+  VkFrontFace front_face = VK_FRONT_FACE_CLOCKWISE;
+
+  // Depth is cleared to 1, nearer fragments have smaller depths
+  bool depth_test = true;
+  bool depth_write = true;
+  VkCompareOp depth_compare = VK_COMPARE_OP_LESS_OR_EQUAL;
+
+  VkPipelineLayout layout = VK_NULL_HANDLE;
+  VkRenderPass render_pass = VK_NULL_HANDLE;
+  uint32_t subpass = 0;
+};
+
+VkPipeline create_graphics_pipeline(BootstrapInfo &bootstrap,
+                                    const GraphicsPipelineDesc &desc) {
+  auto vert = create_shader_module(bootstrap, desc.vert_shader.c_str());
+  auto frag = create_shader_module(bootstrap, desc.frag_shader.c_str());
+
+  VkPipelineShaderStageCreateInfo vert_stage_info = {};
+  vert_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  vert_stage_info.stage = VK_SHADER_STAGE_VERTEX_BIT;
+  vert_stage_info.module = vert;
+  vert_stage_info.pName = "main";
+
+  VkPipelineShaderStageCreateInfo frag_stage_info = {};
+  frag_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  frag_stage_info.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+  frag_stage_info.module = frag;
+  frag_stage_info.pName = "main";
+
+  VkPipelineShaderStageCreateInfo shader_stages[] = {vert_stage_info,
+                                                     frag_stage_info};
+
+  VkPipelineVertexInputStateCreateInfo vertex_input_info = {};
+  vertex_input_info.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+  vertex_input_info.vertexBindingDescriptionCount = desc.bindings.size();
+  vertex_input_info.pVertexBindingDescriptions = desc.bindings.data();
+  vertex_input_info.vertexAttributeDescriptionCount = desc.attributes.size();
+  vertex_input_info.pVertexAttributeDescriptions = desc.attributes.data();
+
+  VkPipelineInputAssemblyStateCreateInfo input_assembly = {};
+  input_assembly.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+  input_assembly.topology = desc.topology;
+  input_assembly.primitiveRestartEnable = VK_FALSE;
+
+  VkPipelineViewportStateCreateInfo viewport_state = {};
+  viewport_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+  viewport_state.viewportCount = 1;
+  viewport_state.scissorCount = 1;
+
+  VkPipelineRasterizationStateCreateInfo rasterizer = {};
+  rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+  rasterizer.depthClampEnable = VK_FALSE;
+  rasterizer.rasterizerDiscardEnable = VK_FALSE;
+  rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+  rasterizer.lineWidth = 1.0f;
+  rasterizer.cullMode = desc.cull_mode;
+  rasterizer.frontFace = desc.front_face;
+  rasterizer.depthBiasEnable = VK_FALSE;
+
+  VkPipelineMultisampleStateCreateInfo multisampling = {};
+  multisampling.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+  multisampling.sampleShadingEnable = VK_FALSE;
+  multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+  VkPipelineDepthStencilStateCreateInfo depth_stencil = {};
+  depth_stencil.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+  depth_stencil.depthTestEnable = desc.depth_test;
+  depth_stencil.depthWriteEnable = desc.depth_write;
+  depth_stencil.depthCompareOp = desc.depth_compare;
+
+  VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
+  colorBlendAttachment.colorWriteMask =
+      VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+      VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+  colorBlendAttachment.blendEnable = VK_FALSE;
+
+  VkPipelineColorBlendStateCreateInfo color_blending = {};
+  color_blending.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+  color_blending.logicOpEnable = VK_FALSE;
+  color_blending.logicOp = VK_LOGIC_OP_COPY;
+  color_blending.attachmentCount = 1;
+  color_blending.pAttachments = &colorBlendAttachment;
+
+  std::vector<VkDynamicState> dynamic_states = {
+      VK_DYNAMIC_STATE_VIEWPORT,
+      VK_DYNAMIC_STATE_SCISSOR,
+  };
+
+  VkPipelineDynamicStateCreateInfo dynamic_info = {};
+  dynamic_info.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+  dynamic_info.dynamicStateCount = static_cast<uint32_t>(dynamic_states.size());
+  dynamic_info.pDynamicStates = dynamic_states.data();
+
+  VkGraphicsPipelineCreateInfo pipeline_info = {};
+  pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+  pipeline_info.stageCount = 2;
+  pipeline_info.pStages = shader_stages;
+  pipeline_info.pVertexInputState = &vertex_input_info;
+  pipeline_info.pInputAssemblyState = &input_assembly;
+  pipeline_info.pViewportState = &viewport_state;
+  pipeline_info.pRasterizationState = &rasterizer;
+  pipeline_info.pMultisampleState = &multisampling;
+  pipeline_info.pDepthStencilState = &depth_stencil;
+  pipeline_info.pColorBlendState = &color_blending;
+  pipeline_info.pDynamicState = &dynamic_info;
+  pipeline_info.layout = desc.layout;
+  pipeline_info.renderPass = desc.render_pass;
+  pipeline_info.subpass = desc.subpass;
+  pipeline_info.basePipelineHandle = VK_NULL_HANDLE;
+
+  VkPipeline pipeline = VK_NULL_HANDLE;
+  CHECK_VK(bootstrap.dispatch.createGraphicsPipelines(
+      bootstrap.pipeline_cache.cache, 1, &pipeline_info, NULL, &pipeline));
+
+  bootstrap.dispatch.destroyShaderModule(vert, NULL);
+  bootstrap.dispatch.destroyShaderModule(frag, NULL);
+
+  return pipeline;
+}
+
+struct ComputePipelineDesc {
+  std::string name;
+  std::string comp_shader;
+  VkPipelineLayout layout = VK_NULL_HANDLE;
+};
+
+VkPipeline create_compute_pipeline(BootstrapInfo &bootstrap,
+                                   const ComputePipelineDesc &desc) {
+  auto comp = create_shader_module(bootstrap, desc.comp_shader.c_str());
+
+  VkComputePipelineCreateInfo pipeline_info = {};
+  pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  pipeline_info.stage.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  pipeline_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+  pipeline_info.stage.module = comp;
+  pipeline_info.stage.pName = "main";
+  pipeline_info.layout = desc.layout;
+
+  VkPipeline pipeline = VK_NULL_HANDLE;
+  CHECK_VK(bootstrap.dispatch.createComputePipelines(
+      bootstrap.pipeline_cache.cache, 1, &pipeline_info, NULL, &pipeline));
+
+  bootstrap.dispatch.destroyShaderModule(comp, NULL);
+
+  return pipeline;
+}
+
+using PipelineHandle = uint32_t;
+
+// Compiles pipelines on a pool of worker threads sharing the pipeline cache,
+// which Vulkan synchronizes internally. Callers poll the handle every frame
+// and skip, or substitute, whatever is not ready yet.
+struct PipelineCompiler {
+  struct Slot {
+    std::string name;
+    std::atomic<VkPipeline> pipeline{VK_NULL_HANDLE};
+  };
+
+  // Deque so that slots never move while workers write to them
+  std::deque<Slot> slots;
+
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable jobs_changed;
+  std::deque<std::function<void()>> jobs;
+  uint32_t jobs_running = 0;
+  bool stopping = false;
+
+  PipelineCompiler() = default;
+  PipelineCompiler(const PipelineCompiler &) = delete;
+  PipelineCompiler &operator=(const PipelineCompiler &) = delete;
+
+  ~PipelineCompiler() { stop(); }
+
+  // Zero threads picks one less than the number of hardware threads, leaving
+  // one for the frame loop
+  void init(uint32_t thread_count = 0) {
+    if (thread_count == 0)
+      thread_count = std::max(2u, std::thread::hardware_concurrency()) - 1;
+
+    for (uint32_t i = 0; i < thread_count; i++)
+      workers.emplace_back([this]() { work(); });
+  }
+
+  void work() {
+    while (true) {
+      std::function<void()> job;
+      {
+        std::unique_lock lock(mutex);
+        jobs_changed.wait(lock, [this]() { return stopping || !jobs.empty(); });
+        if (jobs.empty())
+          return;
+
+        job = std::move(jobs.front());
+        jobs.pop_front();
+        jobs_running++;
+      }
+
+      job();
+
+      {
+        std::lock_guard lock(mutex);
+        jobs_running--;
+      }
+      jobs_changed.notify_all();
+    }
+  }
+
+  PipelineHandle enqueue(const std::string &name,
+                         std::function<VkPipeline()> create) {
+    PipelineHandle handle = slots.size();
+    Slot &slot = slots.emplace_back();
+    slot.name = name;
+
+    {
+      std::lock_guard lock(mutex);
+      jobs.push_back([&slot, create = std::move(create)]() {
+        auto start = std::chrono::steady_clock::now();
+        VkPipeline pipeline = create();
+        slot.pipeline.store(pipeline, std::memory_order_release);
+
+        spdlog::info("Compiled pipeline {} in {:.1f} ms", slot.name,
+                     std::chrono::duration<double, std::milli>(
+                         std::chrono::steady_clock::now() - start)
+                         .count());
+      });
+    }
+    jobs_changed.notify_one();
+
+    return handle;
+  }
+
+  PipelineHandle compile(BootstrapInfo &bootstrap, GraphicsPipelineDesc desc) {
+    std::string name = desc.name;
+    return enqueue(name, [&bootstrap, desc = std::move(desc)]() {
+      return create_graphics_pipeline(bootstrap, desc);
+    });
+  }
+
+  PipelineHandle compile(BootstrapInfo &bootstrap, ComputePipelineDesc desc) {
+    std::string name = desc.name;
+    return enqueue(name, [&bootstrap, desc = std::move(desc)]() {
+      return create_compute_pipeline(bootstrap, desc);
+    });
+  }
+
+  // VK_NULL_HANDLE until the pipeline has been compiled
+  VkPipeline get(PipelineHandle handle) const {
+    return slots[handle].pipeline.load(std::memory_order_acquire);
+  }
+
+  bool is_ready(PipelineHandle handle) const {
+    return get(handle) != VK_NULL_HANDLE;
+  }
+
+  void wait_idle() {
+    std::unique_lock lock(mutex);
+    jobs_changed.wait(lock,
+                      [this]() { return jobs.empty() && jobs_running == 0; });
+  }
+
+  void stop() {
+    {
+      std::lock_guard lock(mutex);
+      stopping = true;
+    }
+    jobs_changed.notify_all();
+
+    for (auto &worker : workers)
+      worker.join();
+    workers.clear();
+  }
+};
+
+} // namespace b::engine
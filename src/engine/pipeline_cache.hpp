@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <VkBootstrap.h>
+#include <vulkan/vulkan.h>
+
+#include "utils/utils.hpp"
+
+namespace b::engine {
+
+// VkPipelineCache persisted to disk between runs. A blob written by another
+// driver or device is discarded instead of being handed to the driver.
+struct PipelineCache {
+  VkPipelineCache cache = VK_NULL_HANDLE;
+  std::string path;
+  // Whether a valid blob was loaded, i.e. pipelines are created warm
+  bool warm = false;
+
+  static bool is_compatible(const std::vector<char> &blob,
+                            const VkPhysicalDeviceProperties &properties) {
+    VkPipelineCacheHeaderVersionOne header = {};
+    if (blob.size() < sizeof(header))
+      return false;
+    std::memcpy(&header, blob.data(), sizeof(header));
+
+    return header.headerSize >= sizeof(header) &&
+           header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+           header.vendorID == properties.vendorID &&
+           header.deviceID == properties.deviceID &&
+           std::memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID,
+                       VK_UUID_SIZE) == 0;
+  }
+
+  void init(vkb::DispatchTable &dispatch,
+            const VkPhysicalDeviceProperties &properties,
+            const char *cache_path) {
+    path = cache_path;
+
+    std::vector<char> blob;
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (file) {
+      blob.resize(file.tellg());
+      file.seekg(0, std::ios::beg);
+      if (file.read(blob.data(), blob.size()).bad())
+        blob.clear();
+    }
+
+    warm = is_compatible(blob, properties);
+    if (!blob.empty() && !warm)
+      spdlog::warn("Discarding the pipeline cache {}, it was created for a "
+                   "different device or driver",
+                   path);
+
+    VkPipelineCacheCreateInfo create_info = {};
+    create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    create_info.initialDataSize = warm ? blob.size() : 0;
+    create_info.pInitialData = warm ? blob.data() : nullptr;
+
+    CHECK_VK(dispatch.createPipelineCache(&create_info, NULL, &cache));
+    spdlog::info("Pipeline cache {} ({} bytes)", warm ? "loaded" : "created",
+                 create_info.initialDataSize);
+  }
+
+  // Written to a temporary file first and renamed over the old one, so an
+  // interrupted write never leaves a truncated cache behind
+  void save(vkb::DispatchTable &dispatch) {
+    if (cache == VK_NULL_HANDLE)
+      return;
+
+    size_t size = 0;
+    CHECK_VK(dispatch.getPipelineCacheData(cache, &size, nullptr));
+    std::vector<char> blob(size);
+    CHECK_VK(dispatch.getPipelineCacheData(cache, &size, blob.data()));
+
+    std::string tmp_path = path + ".tmp";
+    {
+      std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+      if (!file || !file.write(blob.data(), size)) {
+        spdlog::warn("Failed to write the pipeline cache {}", tmp_path);
+        return;
+      }
+    }
+
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+      spdlog::warn("Failed to replace the pipeline cache {}", path);
+      std::remove(tmp_path.c_str());
+    }
+  }
+};
+
+} // namespace b::engine
@@ -0,0 +1,255 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <imgui/imgui.h>
+#include <spdlog/fmt/fmt.h>
+#include <vulkan/vulkan.h>
+
+#include "bootstrap.hpp"
+#include "scope_stats.hpp"
+
+namespace b::engine {
+
+// Named GPU timings backed by a timestamp query pool per frame-in-flight.
+// Results of a frame are only read back once its fence has signalled, so
+// reading never stalls.
+struct GpuProfiler {
+  static constexpr uint32_t MAX_QUERIES = 64;
+  static constexpr uint32_t INVALID_SCOPE = UINT32_MAX;
+
+  struct PendingScope {
+    uint32_t stats_index;
+    uint32_t begin_query;
+    uint32_t end_query;
+  };
+
+  struct FrameQueries {
+    VkQueryPool query_pool = VK_NULL_HANDLE;
+    uint32_t query_count = 0;
+    std::vector<PendingScope> scopes;
+  };
+
+  // Nanoseconds per tick, zero if the graphics queue has no timestamps
+  float timestamp_period = 0.0f;
+  uint64_t timestamp_mask = ~0ull;
+
+  std::vector<FrameQueries> frames;
+  uint32_t current = 0;
+
+  std::vector<ScopeStats> stats;
+  bool record_samples = false;
+
+  bool enabled() const { return timestamp_period > 0.0f; }
+
+  void init(BootstrapInfo &bootstrap, uint32_t frames_in_flight) {
+    auto graphics_family =
+        bootstrap.device.get_queue_index(vkb::QueueType::graphics).value();
+    uint32_t valid_bits =
+        bootstrap.physical_device.get_queue_families()[graphics_family]
+            .timestampValidBits;
+    float period = bootstrap.physical_device.properties.limits.timestampPeriod;
+
+    frames.clear();
+    frames.resize(frames_in_flight);
+
+    if (valid_bits == 0 || period <= 0.0f) {
+      spdlog::warn("GPU timestamps are not supported, profiling is disabled");
+      timestamp_period = 0.0f;
+      return;
+    }
+
+    timestamp_period = period;
+    timestamp_mask = valid_bits >= 64 ? ~0ull : (1ull << valid_bits) - 1;
+
+    VkQueryPoolCreateInfo query_pool_info = {};
+    query_pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    query_pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    query_pool_info.queryCount = MAX_QUERIES;
+
+    for (auto &frame : frames)
+      CHECK_VK(bootstrap.dispatch.createQueryPool(&query_pool_info, NULL,
+                                                  &frame.query_pool));
+  }
+
+  // Collects the timings of the last frame recorded with this frame-in-flight,
+  // its fence must have signalled
+  void begin_frame(BootstrapInfo &bootstrap, uint32_t frame_in_flight) {
+    current = frame_in_flight;
+    if (!enabled())
+      return;
+
+    auto &frame = frames[current];
+    if (frame.query_count > 0) {
+      std::array<uint64_t, MAX_QUERIES> timestamps = {};
+      VkResult result = bootstrap.dispatch.getQueryPoolResults(
+          frame.query_pool, 0, frame.query_count,
+          frame.query_count * sizeof(uint64_t), timestamps.data(),
+          sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+
+      if (result == VK_SUCCESS) {
+        for (auto &scope : frame.scopes) {
+          uint64_t ticks =
+              (timestamps[scope.end_query] - timestamps[scope.begin_query]) &
+              timestamp_mask;
+          stats[scope.stats_index].push(ticks * timestamp_period / 1e6f,
+                                        record_samples);
+        }
+      }
+    }
+
+    frame.query_count = 0;
+    frame.scopes.clear();
+  }
+
+  // Has to be recorded before any scope of the current frame
+  void cmd_reset(BootstrapInfo &bootstrap, VkCommandBuffer command_buffer) {
+    if (!enabled())
+      return;
+
+    bootstrap.dispatch.cmdResetQueryPool(
+        command_buffer, frames[current].query_pool, 0, MAX_QUERIES);
+  }
+
+  // Scopes may begin and end in different command buffers as long as they
+  // are part of the same frame
+  uint32_t begin_scope(BootstrapInfo &bootstrap, VkCommandBuffer command_buffer,
+                       const char *name) {
+    auto &frame = frames[current];
+    if (!enabled() || frame.query_count + 2 > MAX_QUERIES)
+      return INVALID_SCOPE;
+
+    PendingScope scope = {};
+    scope.stats_index = find_or_add_stats(name);
+    scope.begin_query = frame.query_count++;
+    scope.end_query = frame.query_count++;
+
+    bootstrap.dispatch.cmdWriteTimestamp(command_buffer,
+                                         VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                                         frame.query_pool, scope.begin_query);
+
+    frame.scopes.push_back(scope);
+    return frame.scopes.size() - 1;
+  }
+
+  void end_scope(BootstrapInfo &bootstrap, VkCommandBuffer command_buffer,
+                 uint32_t scope) {
+    if (scope == INVALID_SCOPE)
+      return;
+
+    auto &frame = frames[current];
+    bootstrap.dispatch.cmdWriteTimestamp(
+        command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frame.query_pool,
+        frame.scopes[scope].end_query);
+  }
+
+  uint32_t find_or_add_stats(const char *name) {
+    for (uint32_t i = 0; i < stats.size(); i++)
+      if (stats[i].name == name)
+        return i;
+
+    ScopeStats scope_stats;
+    scope_stats.name = name;
+    stats.push_back(std::move(scope_stats));
+    return stats.size() - 1;
+  }
+
+  float latest_ms(const char *name) const {
+    for (auto &scope_stats : stats)
+      if (scope_stats.name == name)
+        return scope_stats.latest_ms;
+    return 0.0f;
+  }
+
+  void draw_imgui() {
+    ImGui::Begin("GPU Profiler");
+
+    if (!enabled())
+      ImGui::TextUnformatted("Timestamps are not supported on this device");
+
+    for (auto &scope_stats : stats) {
+      float max_ms = 0.0f;
+      for (size_t i = 0; i < scope_stats.history_size; i++)
+        max_ms = std::max(max_ms, scope_stats.history[i]);
+
+      auto overlay = fmt::format("avg {:.3f} ms, last {:.3f} ms",
+                                 scope_stats.average_ms(),
+                                 scope_stats.latest_ms);
+      ImGui::PlotHistogram(scope_stats.name.c_str(),
+                           scope_stats.history.data(),
+                           scope_stats.history_size,
+                           scope_stats.history_size < ScopeStats::HISTORY
+                               ? 0
+                               : scope_stats.history_head,
+                           overlay.c_str(), 0.0f, max_ms * 1.25f,
+                           ImVec2(0, 48));
+    }
+
+    ImGui::End();
+  }
+
+  std::string to_csv() const {
+    std::string csv = "scope,sample,gpu_ms\n";
+    for (auto &scope_stats : stats) {
+      auto samples = scope_stats.ordered_samples();
+      for (size_t i = 0; i < samples.size(); i++)
+        csv += fmt::format("{},{},{:.6f}\n", scope_stats.name, i, samples[i]);
+    }
+    return csv;
+  }
+
+  std::string to_json() const {
+    std::string json = "{\"scopes\":[";
+    for (size_t i = 0; i < stats.size(); i++) {
+      if (i > 0)
+        json += ",";
+      json += fmt::format("{{\"name\":\"{}\",\"average_ms\":{:.6f},"
+                          "\"samples_ms\":[",
+                          stats[i].name, stats[i].average_ms());
+
+      auto samples = stats[i].ordered_samples();
+      for (size_t j = 0; j < samples.size(); j++)
+        json += fmt::format("{}{:.6f}", j > 0 ? "," : "", samples[j]);
+      json += "]}";
+    }
+    json += "]}\n";
+    return json;
+  }
+
+  // The format is picked by the extension, either .csv or .json
+  void export_to_file(const char *path) const {
+    std::ofstream file(path);
+    CHECK_REPORT_FMT(file, "Failed to open the file {}", path);
+
+    size_t length = std::strlen(path);
+    bool is_csv = length >= 4 && std::strcmp(path + length - 4, ".csv") == 0;
+    file << (is_csv ? to_csv() : to_json());
+  }
+};
+
+// Times the commands recorded during its lifetime
+struct GpuScope {
+  GpuScope(GpuProfiler &profiler, BootstrapInfo &bootstrap,
+           VkCommandBuffer command_buffer, const char *name)
+      : profiler(profiler), bootstrap(bootstrap),
+        command_buffer(command_buffer) {
+    scope = profiler.begin_scope(bootstrap, command_buffer, name);
+  }
+
+  GpuScope(const GpuScope &) = delete;
+  GpuScope &operator=(const GpuScope &) = delete;
+
+  ~GpuScope() { profiler.end_scope(bootstrap, command_buffer, scope); }
+
+  GpuProfiler &profiler;
+  BootstrapInfo &bootstrap;
+  VkCommandBuffer command_buffer;
+  uint32_t scope;
+};
+
+} // namespace b::engine
@@ -0,0 +1,237 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <VkBootstrap.h>
+#include <vulkan/vulkan.h>
+
+#include "bootstrap.hpp"
+#include "utils/utils.hpp"
+
+namespace b::engine {
+
+// Splits a frame's draws into chunks recorded into secondary command buffers
+// on several threads, for the primary buffer to execute inside the render
+// pass. Every (thread, frame in flight) pair owns a command pool, so pools
+// are never shared between threads and are only reset once the frame's fence
+// has been waited on. Command buffers are reused after the reset, in steady
+// state nothing is allocated.
+struct ParallelRecorder {
+  struct ThreadFrame {
+    VkCommandPool pool = VK_NULL_HANDLE;
+    std::vector<VkCommandBuffer> command_buffers;
+    // Command buffers handed out since the last reset
+    uint32_t used = 0;
+  };
+
+  using RecordFn = void (*)(void *context, VkCommandBuffer command_buffer,
+                            uint32_t begin, uint32_t end);
+
+  // The calling thread records as well, one thread means no workers
+  uint32_t thread_count = 1;
+  uint32_t frames_in_flight = 0;
+  // Smaller chunks are not worth a secondary buffer of their own
+  uint32_t min_chunk_size = 256;
+  // More chunks than threads balances uneven chunks out
+  uint32_t chunks_per_thread = 4;
+
+  // Indexed by thread * frames_in_flight + frame
+  std::vector<ThreadFrame> thread_frames;
+  // Recorded chunks in draw order
+  std::vector<VkCommandBuffer> secondaries;
+
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable job_posted, job_done;
+  uint64_t generation = 0;
+  uint32_t workers_busy = 0;
+  bool stopping = false;
+
+  // The job being recorded, only written while the workers are idle
+  BootstrapInfo *job_bootstrap = nullptr;
+  uint32_t job_frame = 0;
+  VkCommandBufferInheritanceInfo job_inheritance = {};
+  RecordFn job_fn = nullptr;
+  void *job_context = nullptr;
+  uint32_t job_item_count = 0;
+  uint32_t job_chunk_size = 0;
+  uint32_t job_chunk_count = 0;
+  std::atomic<uint32_t> next_chunk{0};
+
+  ParallelRecorder() = default;
+  ParallelRecorder(const ParallelRecorder &) = delete;
+  ParallelRecorder &operator=(const ParallelRecorder &) = delete;
+
+  ~ParallelRecorder() { stop(); }
+
+  // Zero threads picks the number of hardware threads
+  void init(BootstrapInfo &bootstrap, uint32_t frame_count,
+            uint32_t threads = 0) {
+    if (threads == 0)
+      threads = std::max(1u, std::thread::hardware_concurrency());
+    thread_count = threads;
+    frames_in_flight = frame_count;
+
+    VkCommandPoolCreateInfo pool_info = {};
+    pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    pool_info.queueFamilyIndex = bootstrap.graphics_queue_family();
+
+    thread_frames.resize(thread_count * frames_in_flight);
+    for (auto &thread_frame : thread_frames)
+      CHECK_VK(bootstrap.dispatch.createCommandPool(&pool_info, NULL,
+                                                    &thread_frame.pool));
+
+    stopping = false;
+    for (uint32_t i = 1; i < thread_count; i++)
+      workers.emplace_back([this, i]() { work(i); });
+  }
+
+  void destroy(BootstrapInfo &bootstrap) {
+    stop();
+    for (auto &thread_frame : thread_frames)
+      bootstrap.dispatch.destroyCommandPool(thread_frame.pool, nullptr);
+    thread_frames.clear();
+  }
+
+  // The fence of the frame must have been waited on
+  void begin_frame(BootstrapInfo &bootstrap, uint32_t frame) {
+    for (uint32_t thread = 0; thread < thread_count; thread++) {
+      ThreadFrame &thread_frame =
+          thread_frames[thread * frames_in_flight + frame];
+      CHECK_VK(bootstrap.dispatch.resetCommandPool(thread_frame.pool, 0));
+      thread_frame.used = 0;
+    }
+  }
+
+  VkCommandBuffer acquire(BootstrapInfo &bootstrap,
+                          ThreadFrame &thread_frame) {
+    if (thread_frame.used == thread_frame.command_buffers.size()) {
+      VkCommandBufferAllocateInfo alloc_info = {};
+      alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+      alloc_info.commandPool = thread_frame.pool;
+      alloc_info.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+      alloc_info.commandBufferCount = 1;
+
+      VkCommandBuffer command_buffer;
+      CHECK_VK(bootstrap.dispatch.allocateCommandBuffers(&alloc_info,
+                                                         &command_buffer));
+      thread_frame.command_buffers.push_back(command_buffer);
+    }
+
+    return thread_frame.command_buffers[thread_frame.used++];
+  }
+
+  void record_chunks(uint32_t thread) {
+    BootstrapInfo &bootstrap = *job_bootstrap;
+    ThreadFrame &thread_frame =
+        thread_frames[thread * frames_in_flight + job_frame];
+
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+                       VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    begin_info.pInheritanceInfo = &job_inheritance;
+
+    for (uint32_t chunk = next_chunk++; chunk < job_chunk_count;
+         chunk = next_chunk++) {
+      VkCommandBuffer command_buffer = acquire(bootstrap, thread_frame);
+      uint32_t begin = chunk * job_chunk_size;
+      uint32_t end = std::min(job_item_count, begin + job_chunk_size);
+
+      CHECK_VK(
+          bootstrap.dispatch.beginCommandBuffer(command_buffer, &begin_info));
+      job_fn(job_context, command_buffer, begin, end);
+      CHECK_VK(bootstrap.dispatch.endCommandBuffer(command_buffer));
+
+      secondaries[chunk] = command_buffer;
+    }
+  }
+
+  void work(uint32_t thread) {
+    uint64_t seen = 0;
+    while (true) {
+      {
+        std::unique_lock lock(mutex);
+        job_posted.wait(lock,
+                        [&]() { return stopping || generation != seen; });
+        if (stopping)
+          return;
+        seen = generation;
+      }
+
+      record_chunks(thread);
+
+      {
+        std::lock_guard lock(mutex);
+        workers_busy--;
+      }
+      job_done.notify_one();
+    }
+  }
+
+  // Records `record(command_buffer, begin, end)` over [0, item_count) and
+  // returns the secondary buffers in order. Secondary buffers inherit no
+  // dynamic state, `record` has to set the viewport and scissor itself.
+  template <typename F>
+  const std::vector<VkCommandBuffer> &
+  record(BootstrapInfo &bootstrap, uint32_t frame,
+         const VkCommandBufferInheritanceInfo &inheritance,
+         uint32_t item_count, F &record) {
+    uint32_t max_chunks = thread_count * chunks_per_thread;
+    uint32_t chunk_size = std::max(
+        min_chunk_size, (item_count + max_chunks - 1) / max_chunks);
+    uint32_t chunk_count =
+        std::max(1u, (item_count + chunk_size - 1) / chunk_size);
+
+    job_bootstrap = &bootstrap;
+    job_frame = frame;
+    job_inheritance = inheritance;
+    job_fn = [](void *context, VkCommandBuffer command_buffer, uint32_t begin,
+                uint32_t end) { (*(F *)context)(command_buffer, begin, end); };
+    job_context = &record;
+    job_item_count = item_count;
+    job_chunk_size = chunk_size;
+    job_chunk_count = chunk_count;
+    next_chunk = 0;
+    secondaries.resize(chunk_count);
+
+    // Not worth waking the workers for a single chunk
+    if (chunk_count == 1 || workers.empty()) {
+      record_chunks(0);
+      return secondaries;
+    }
+
+    {
+      std::lock_guard lock(mutex);
+      workers_busy = workers.size();
+      generation++;
+    }
+    job_posted.notify_all();
+
+    record_chunks(0);
+
+    std::unique_lock lock(mutex);
+    job_done.wait(lock, [this]() { return workers_busy == 0; });
+    return secondaries;
+  }
+
+  void stop() {
+    {
+      std::lock_guard lock(mutex);
+      stopping = true;
+    }
+    job_posted.notify_all();
+
+    for (auto &worker : workers)
+      worker.join();
+    workers.clear();
+  }
+};
+
+} // namespace b::engine
@@ -0,0 +1,416 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <imgui/imgui.h>
+#include <vulkan/vulkan.h>
+
+#include "arena.hpp"
+#include "bootstrap.hpp"
+#include "frame_ring.hpp"
+#include "pipeline.hpp"
+
+namespace b::engine {
+
+// 64-bit draw sort key, from the most significant bits down: pass, pipeline,
+// material, mesh and depth. Sorting by it groups the draws that share state,
+// and front to back within them.
+struct SortKey {
+  static constexpr uint32_t DEPTH_BITS = 18;
+  static constexpr uint32_t MESH_BITS = 16;
+  static constexpr uint32_t MATERIAL_BITS = 16;
+  static constexpr uint32_t PIPELINE_BITS = 10;
+  static constexpr uint32_t PASS_BITS = 4;
+
+  static constexpr uint32_t MESH_SHIFT = DEPTH_BITS;
+  static constexpr uint32_t MATERIAL_SHIFT = MESH_SHIFT + MESH_BITS;
+  static constexpr uint32_t PIPELINE_SHIFT = MATERIAL_SHIFT + MATERIAL_BITS;
+  static constexpr uint32_t PASS_SHIFT = PIPELINE_SHIFT + PIPELINE_BITS;
+  static_assert(PASS_SHIFT + PASS_BITS == 64);
+
+  static constexpr uint32_t field(uint64_t key, uint32_t shift,
+                                  uint32_t bits) {
+    return (key >> shift) & ((1ull << bits) - 1);
+  }
+
+  // Depth is clamped to [0, 1], NaN sorts as 0
+  static uint64_t make(uint32_t pass, PipelineHandle pipeline,
+                       uint32_t material, uint32_t mesh, float depth) {
+    constexpr uint32_t max_depth = (1u << DEPTH_BITS) - 1;
+    float clamped = !(depth >= 0.0f) ? 0.0f : std::min(depth, 1.0f);
+    uint32_t quantized = clamped * max_depth;
+    return (uint64_t)pass << PASS_SHIFT |
+           (uint64_t)pipeline << PIPELINE_SHIFT |
+           (uint64_t)material << MATERIAL_SHIFT |
+           (uint64_t)mesh << MESH_SHIFT | quantized;
+  }
+
+  static PipelineHandle pipeline(uint64_t key) {
+    return field(key, PIPELINE_SHIFT, PIPELINE_BITS);
+  }
+  static uint32_t material(uint64_t key) {
+    return field(key, MATERIAL_SHIFT, MATERIAL_BITS);
+  }
+  static uint32_t mesh(uint64_t key) {
+    return field(key, MESH_SHIFT, MESH_BITS);
+  }
+};
+
+// Draws collected for the frame, radix sorted by their keys and recorded
+// with only the pipeline, vertex buffer and index buffer binds that change
+// from one draw to the next. Meshes are registered per frame and referred to
+// by their registration order, register meshes sharing an arena page
+// together so they end up next to each other.
+//
+// Every pipeline drawn through the queue has to use the same layout, with
+// DrawPushConstants as its push constants.
+//
+// Large queues are sorted on a worker pool: each thread owns a contiguous
+// block of packets, counts its bytes and scatters them to offsets computed
+// from every block's counts, which keeps the sort stable.
+struct RenderQueue {
+  struct Packet {
+    uint64_t key;
+    // Index in the frame's transforms, passed with the material as push
+    // constants
+    uint32_t object;
+  };
+
+  enum class SortJob {
+    // The histograms of every byte of the block
+    HISTOGRAMS,
+    // The histogram of job_digit only, the blocks hold other packets by now
+    HISTOGRAM,
+    SCATTER,
+  };
+
+  using Histogram = std::array<uint32_t, 256>;
+
+  struct Stats {
+    uint32_t packets = 0;
+    // Threads the last sort ran on
+    uint32_t sort_threads = 1;
+    double sort_ms = 0.0;
+    // Binds recorded, and those skipped because the state was already bound
+    std::atomic<uint32_t> binds{0};
+    std::atomic<uint32_t> binds_avoided{0};
+  };
+
+  std::vector<Packet> packets;
+  std::vector<Packet> scratch;
+  std::vector<Mesh> meshes;
+  Stats stats;
+
+  // The calling thread sorts as well, one thread means no workers
+  uint32_t thread_count = 1;
+  // Smaller queues are sorted on the calling thread alone
+  uint32_t parallel_threshold = 1 << 16;
+
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable job_posted, job_done;
+  uint64_t generation = 0;
+  uint32_t workers_busy = 0;
+  bool stopping = false;
+
+  // The job being sorted, only written while the workers are idle
+  SortJob job = SortJob::HISTOGRAMS;
+  uint32_t job_digit = 0;
+  Packet *job_src = nullptr;
+  Packet *job_dst = nullptr;
+  uint32_t job_count = 0;
+  uint32_t job_block_size = 0;
+  uint32_t job_block_count = 0;
+  // Indexed by block
+  std::vector<std::array<Histogram, 8>> block_histograms;
+  std::vector<Histogram> block_offsets;
+  std::atomic<uint32_t> next_block{0};
+
+  RenderQueue() = default;
+  RenderQueue(const RenderQueue &) = delete;
+  RenderQueue &operator=(const RenderQueue &) = delete;
+
+  ~RenderQueue() { stop(); }
+
+  // Zero threads picks the number of hardware threads
+  void init(uint32_t threads = 1) {
+    stop();
+    if (threads == 0)
+      threads = std::max(1u, std::thread::hardware_concurrency());
+    thread_count = threads;
+
+    stopping = false;
+    for (uint32_t i = 1; i < thread_count; i++)
+      workers.emplace_back([this]() { work(); });
+  }
+
+  void begin_frame() {
+    packets.clear();
+    meshes.clear();
+  }
+
+  uint32_t add_mesh(const Mesh &mesh) {
+    CHECK_REPORT_FMT(meshes.size() < (1u << SortKey::MESH_BITS),
+                     "At most {} meshes can be queued per frame",
+                     1u << SortKey::MESH_BITS);
+    meshes.push_back(mesh);
+    return meshes.size() - 1;
+  }
+
+  void push(uint32_t pass, PipelineHandle pipeline, uint32_t material,
+            uint32_t mesh, float depth, uint32_t object) {
+    CHECK(pass < (1u << SortKey::PASS_BITS) &&
+          pipeline < (1u << SortKey::PIPELINE_BITS) &&
+          material < (1u << SortKey::MATERIAL_BITS));
+    packets.push_back(
+        {SortKey::make(pass, pipeline, material, mesh, depth), object});
+  }
+
+  // Stable LSD radix sort, a byte per pass. The histograms of every byte are
+  // built in a single read and bytes shared by every key are skipped, so a
+  // queue of identical state only costs that read.
+  void sort() {
+    auto start = std::chrono::steady_clock::now();
+    stats.packets = packets.size();
+    stats.binds = 0;
+    stats.binds_avoided = 0;
+
+    scratch.resize(packets.size());
+    bool parallel = packets.size() >= parallel_threshold && !workers.empty();
+    if (parallel)
+      sort_parallel();
+    else
+      sort_serial();
+    stats.sort_threads = parallel ? thread_count : 1;
+
+    stats.sort_ms = std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+  }
+
+  void sort_serial() {
+    size_t count = packets.size();
+    std::array<Histogram, 8> histograms = {};
+    for (const Packet &packet : packets)
+      for (uint32_t digit = 0; digit < 8; digit++)
+        histograms[digit][(packet.key >> (digit * 8)) & 0xff]++;
+
+    Packet *src = packets.data();
+    Packet *dst = scratch.data();
+    for (uint32_t digit = 0; digit < 8 && count > 0; digit++) {
+      uint32_t shift = digit * 8;
+      auto &histogram = histograms[digit];
+      if (histogram[(src[0].key >> shift) & 0xff] == count)
+        continue;
+
+      Histogram offsets;
+      uint32_t offset = 0;
+      for (uint32_t bucket = 0; bucket < 256; bucket++) {
+        offsets[bucket] = offset;
+        offset += histogram[bucket];
+      }
+      for (size_t i = 0; i < count; i++)
+        dst[offsets[(src[i].key >> shift) & 0xff]++] = src[i];
+      std::swap(src, dst);
+    }
+    if (src != packets.data())
+      packets.swap(scratch);
+  }
+
+  void sort_blocks() {
+    uint32_t shift = job_digit * 8;
+    for (uint32_t block = next_block++; block < job_block_count;
+         block = next_block++) {
+      uint32_t begin = block * job_block_size;
+      uint32_t end = std::min(job_count, begin + job_block_size);
+
+      switch (job) {
+      case SortJob::HISTOGRAMS: {
+        auto &histograms = block_histograms[block];
+        histograms = {};
+        for (uint32_t i = begin; i < end; i++)
+          for (uint32_t digit = 0; digit < 8; digit++)
+            histograms[digit][(job_src[i].key >> (digit * 8)) & 0xff]++;
+        break;
+      }
+      case SortJob::HISTOGRAM: {
+        Histogram &histogram = block_histograms[block][job_digit];
+        histogram = {};
+        for (uint32_t i = begin; i < end; i++)
+          histogram[(job_src[i].key >> shift) & 0xff]++;
+        break;
+      }
+      case SortJob::SCATTER: {
+        Histogram &offsets = block_offsets[block];
+        for (uint32_t i = begin; i < end; i++)
+          job_dst[offsets[(job_src[i].key >> shift) & 0xff]++] = job_src[i];
+        break;
+      }
+      }
+    }
+  }
+
+  void run(SortJob sort_job) {
+    job = sort_job;
+    next_block = 0;
+    {
+      std::lock_guard lock(mutex);
+      workers_busy = workers.size();
+      generation++;
+    }
+    job_posted.notify_all();
+
+    sort_blocks();
+
+    std::unique_lock lock(mutex);
+    job_done.wait(lock, [this]() { return workers_busy == 0; });
+  }
+
+  void work() {
+    uint64_t seen = 0;
+    while (true) {
+      {
+        std::unique_lock lock(mutex);
+        job_posted.wait(lock,
+                        [&]() { return stopping || generation != seen; });
+        if (stopping)
+          return;
+        seen = generation;
+      }
+
+      sort_blocks();
+
+      {
+        std::lock_guard lock(mutex);
+        workers_busy--;
+      }
+      job_done.notify_one();
+    }
+  }
+
+  void sort_parallel() {
+    job_count = packets.size();
+    job_block_count = thread_count;
+    job_block_size = (job_count + thread_count - 1) / thread_count;
+    block_histograms.resize(job_block_count);
+    block_offsets.resize(job_block_count);
+    job_src = packets.data();
+    job_dst = scratch.data();
+    run(SortJob::HISTOGRAMS);
+
+    // The blocks' histograms of a byte sum up to the whole queue's however
+    // the packets have moved, only their split between blocks goes stale
+    bool fresh = true;
+    for (uint32_t digit = 0; digit < 8; digit++) {
+      Histogram total = {};
+      for (auto &histograms : block_histograms)
+        for (uint32_t bucket = 0; bucket < 256; bucket++)
+          total[bucket] += histograms[digit][bucket];
+      if (std::find(total.begin(), total.end(), job_count) != total.end())
+        continue;
+
+      job_digit = digit;
+      if (!fresh)
+        run(SortJob::HISTOGRAM);
+
+      // Bucket by bucket, every block's packets follow those of the blocks
+      // before it
+      uint32_t offset = 0;
+      for (uint32_t bucket = 0; bucket < 256; bucket++)
+        for (uint32_t block = 0; block < job_block_count; block++) {
+          block_offsets[block][bucket] = offset;
+          offset += block_histograms[block][digit][bucket];
+        }
+
+      run(SortJob::SCATTER);
+      std::swap(job_src, job_dst);
+      fresh = false;
+    }
+    if (job_src != packets.data())
+      packets.swap(scratch);
+  }
+
+  // Records [begin, end) of the sorted packets, inside of the render pass.
+  // The descriptor sets have to be bound, the binds start from scratch so
+  // ranges can be recorded into separate command buffers concurrently.
+  void cmd_draw(BootstrapInfo &bootstrap, VkCommandBuffer command_buffer,
+                const PipelineCompiler &pipelines, VkPipelineLayout layout,
+                uint32_t begin, uint32_t end) {
+    VkPipeline bound_pipeline = VK_NULL_HANDLE;
+    VkBuffer bound_vert_buffer = VK_NULL_HANDLE;
+    VkBuffer bound_index_buffer = VK_NULL_HANDLE;
+    VkIndexType bound_index_type = VK_INDEX_TYPE_MAX_ENUM;
+    uint32_t binds = 0;
+
+    for (uint32_t i = begin; i < end; i++) {
+      const Packet &packet = packets[i];
+      const Mesh &mesh = meshes[SortKey::mesh(packet.key)];
+
+      VkPipeline pipeline = pipelines.get(SortKey::pipeline(packet.key));
+      if (pipeline != bound_pipeline) {
+        bootstrap.dispatch.cmdBindPipeline(
+            command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+        bound_pipeline = pipeline;
+        binds++;
+      }
+      if (mesh.vert_buffer != bound_vert_buffer) {
+        VkDeviceSize offset = 0;
+        bootstrap.dispatch.cmdBindVertexBuffers(command_buffer, 0, 1,
+                                                &mesh.vert_buffer, &offset);
+        bound_vert_buffer = mesh.vert_buffer;
+        binds++;
+      }
+      if (mesh.index_buffer != bound_index_buffer ||
+          mesh.index_type != bound_index_type) {
+        bootstrap.dispatch.cmdBindIndexBuffer(command_buffer,
+                                              mesh.index_buffer, 0,
+                                              mesh.index_type);
+        bound_index_buffer = mesh.index_buffer;
+        bound_index_type = mesh.index_type;
+        binds++;
+      }
+
+      DrawPushConstants push = {packet.object,
+                                SortKey::material(packet.key)};
+      bootstrap.dispatch.cmdPushConstants(command_buffer, layout,
+                                          VK_SHADER_STAGE_VERTEX_BIT, 0,
+                                          sizeof(push), &push);
+      bootstrap.dispatch.cmdDrawIndexed(command_buffer, mesh.index_count, 1,
+                                        mesh.first_index, mesh.vertex_offset,
+                                        0);
+    }
+
+    // Binding everything for every draw takes three binds
+    stats.binds += binds;
+    stats.binds_avoided += (end - begin) * 3 - binds;
+  }
+
+  void stop() {
+    {
+      std::lock_guard lock(mutex);
+      stopping = true;
+    }
+    job_posted.notify_all();
+    for (auto &worker : workers)
+      worker.join();
+    workers.clear();
+  }
+
+  void draw_imgui() {
+    ImGui::Begin("Render queue");
+    ImGui::Text("%u draws, sorted in %.3f ms on %u threads", stats.packets,
+                stats.sort_ms, stats.sort_threads);
+    ImGui::Text("%u binds, %u avoided", stats.binds.load(),
+                stats.binds_avoided.load());
+    ImGui::End();
+  }
+};
+
+} // namespace b::engine
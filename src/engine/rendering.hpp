@@ -5,10 +5,25 @@
 
 #include <vulkan/vulkan.h>
 
-#include <fstream>
+#include <algorithm>
+#include <array>
+#include <chrono>
 #include <vector>
 
+#include "arena.hpp"
+#include "bindless.hpp"
 #include "bootstrap.hpp"
+#include "culling.hpp"
+#include "frame_pacing.hpp"
+#include "frame_ring.hpp"
+#include "gpu_scene.hpp"
+#include "hiz.hpp"
+#include "instancing.hpp"
+#include "memory_budget.hpp"
+#include "pipeline.hpp"
+#include "profiler.hpp"
+#include "recording.hpp"
+#include "render_queue.hpp"
 
 #include "vertex.hpp"
 
@@ -17,54 +32,129 @@ namespace b::engine {
 static Mesh *mesh;
 
 struct FrameData {
-  VkImage swapchain_image;
-  VkImageView swapchain_image_view;
+  VkImage image;
+  VkImageView image_view;
+  // Only set for offscreen images in headless mode, swapchain images are
+  // owned by the swapchain
+  VmaAllocation image_allocation = VK_NULL_HANDLE;
   VkFramebuffer framebuffer;
-  VkCommandBuffer command_buffer;
   VkFence image_in_flight;
 };
 
 struct FrameInFlight {
   VkSemaphore available_semaphore, finished_semaphore;
   VkFence in_flight_fence;
+  // Reset as a whole once the fence signals, the command buffers allocated
+  // from it are reused frame after frame
   VkCommandPool per_frame_command_pool;
+  std::vector<VkCommandBuffer> command_buffers;
+  // Command buffers handed out since the last reset
+  uint32_t command_buffers_used = 0;
+  // Secondary for ImGui when the scene pass executes secondaries
+  VkCommandBuffer imgui_command_buffer;
 };
 
-VkShaderModule create_shader_module(BootstrapInfo &bootstrap,
-                                    const char *filename) {
-  std::ifstream file(filename, std::ios::binary | std::ios::ate);
-  CHECK_REPORT_FMT(file, "Failed to open the file {}", filename);
-  std::streamsize size = file.tellg();
-  file.seekg(0, std::ios::beg);
-  std::vector<char> buffer(size);
-  CHECK(!file.read(buffer.data(), size).bad());
-
-  VkShaderModuleCreateInfo create_info = {};
-  create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-  create_info.codeSize = size;
-  create_info.pCode = (uint32_t *)buffer.data();
-
-  VkShaderModule shader;
-  CHECK_VK(bootstrap.dispatch.createShaderModule(&create_info, NULL, &shader));
-  return shader;
-}
-
 struct RenderData {
+  // Has to be set before init. One trades CPU and GPU overlap for latency.
   uint32_t MAX_FRAMES_IN_FLIGHT = 2;
 
   VkQueue graphics_queue;
   VkQueue present_queue;
 
+  // Clears the targets, the resume pass loads them to draw more on top. The
+  // early pass of occlusion culling stores the depth for the pyramid, the
+  // others drop it. All are compatible with the pipelines and framebuffers.
   VkRenderPass render_pass;
+  VkRenderPass early_render_pass;
+  VkRenderPass resume_render_pass;
   VkPipelineLayout pipeline_layout;
-  VkPipeline pipeline;
-
-  VkCommandPool command_pool;
+  PipelineCompiler pipelines;
+  PipelineHandle scene_pipeline;
+  PipelineHandle instanced_pipeline;
+
+  // Pushed to between begin_frame and draw_frame, drawn after the scene
+  InstanceBuffer instances;
+  // Whether begin_frame was called for the frame being built
+  bool frame_begun = false;
+
+  // Draws gpu_scene instead of the mesh, has to be set before init
+  bool gpu_driven = false;
+  GpuScene gpu_scene;
+  // Depth target, and the pyramid the GPU scene is occlusion culled with
+  DepthPyramid depth_pyramid;
+  // Draws the GPU scene in two phases around a depth pyramid build, see
+  // GpuScene. Can be toggled at any time.
+  bool occlusion_culling = false;
+  glm::mat4 view_projection = glm::mat4(1.0f);
+
+  // Per-frame uniforms and transforms, bound as set 0 of every pipeline
+  FrameRing frame_ring;
+  // Transforms of the scene draws, pushed for the frame being built
+  glm::mat4 *scene_transforms = nullptr;
+  uint32_t scene_transform_offset = 0;
+  uint32_t frame_uniform_offset = 0;
+
+  // Textures and materials, bound as set 1 of every pipeline
+  BindlessResources bindless;
+  // Material of the scene draws
+  uint32_t scene_material = 0;
+
+  // Sorted and drawn every frame with the scene draws in it, unless the scene
+  // is GPU driven. Packets may be pushed between begin_frame and draw_frame,
+  // their pipelines have to use pipeline_layout and be compiled, and their
+  // objects index the scene transforms.
+  RenderQueue render_queue;
+  // Threads sorting large queues, has to be set before init
+  uint32_t sorting_threads = 1;
+  // Front to back order of the scene draws in [0, 1], zero unless written
+  std::vector<float> scene_depths;
+
+  // Frame begin, and the scene with ImGui on top
+  static constexpr uint32_t FRAME_COMMAND_BUFFERS = 2;
+  // Reused for every submission to keep its capacity
+  std::vector<VkCommandBuffer> submit_command_buffers;
 
   std::vector<FrameData> frames;
   std::vector<FrameInFlight> frames_in_flight;
 
   size_t current_frame = 0;
+  // Monotonic counter, used to cycle offscreen images in headless mode
+  uint64_t frame_index = 0;
+
+  uint32_t swapchain_recreations = 0;
+
+  FramePacer pacer;
+  MemoryTelemetry memory;
+
+  // Number of times the scene mesh is drawn, used to scale benchmark scenes
+  uint32_t scene_draw_count = 1;
+
+  // The scene is recorded every frame, inline when zero and otherwise into
+  // secondary buffers on that many threads. The GPU-driven scene is always
+  // recorded inline as it is only a handful of commands.
+  uint32_t recording_threads = 0;
+  ParallelRecorder recorder;
+  // CPU time spent recording the scene in the last frame
+  double scene_record_ms = 0.0;
+  // Render pass instances begun in the last frame, each one stores the color
+  // target. The resumed ones load the targets instead of clearing them, the
+  // depth storing ones feed the pyramid.
+  uint32_t render_pass_instances = 0;
+  uint32_t resumed_render_passes = 0;
+  uint32_t depth_storing_passes = 0;
+
+  // Frustum culls the scene draws on the CPU. The store then holds a
+  // transform and bounds per scene draw and replaces push_scene_transforms,
+  // only the visible transforms are written to the frame ring.
+  bool cpu_culling = false;
+  uint32_t culling_threads = 1;
+  CullStore scene_objects;
+  FrustumCuller culler;
+
+  GpuProfiler profiler;
+  // Scopes spanning several command buffers of the frame being recorded
+  uint32_t frame_gpu_scope = GpuProfiler::INVALID_SCOPE;
+  uint32_t scene_gpu_scope = GpuProfiler::INVALID_SCOPE;
 
   VkDescriptorPool imgui_descriptor_pool;
 
@@ -74,210 +164,229 @@ struct RenderData {
     CHECK(graphics_queue_ret);
     graphics_queue = graphics_queue_ret.value();
 
+    if (bootstrap.headless) {
+      present_queue = VK_NULL_HANDLE;
+      return;
+    }
+
     auto present_queue_ret =
         bootstrap.device.get_queue(vkb::QueueType::present);
     CHECK(present_queue_ret);
     present_queue = present_queue_ret.value();
   }
 
-  void init_render_pass(BootstrapInfo &bootstrap) {
-    VkAttachmentDescription color_attachment = {};
-    color_attachment.format = bootstrap.swapchain.image_format;
+  // The depth is left readable by compute shaders for the pyramid build, its
+  // contents only when stored
+  VkRenderPass create_render_pass(BootstrapInfo &bootstrap, bool resume,
+                                  bool store_depth) {
+    VkImageLayout present_layout = bootstrap.headless
+                                       ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+                                       : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+    std::array<VkAttachmentDescription, 2> attachments = {};
+    VkAttachmentDescription &color_attachment = attachments[0];
+    color_attachment.format = bootstrap.image_format();
     color_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
-    color_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    color_attachment.loadOp =
+        resume ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR;
     color_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
     color_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     color_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    color_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    color_attachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    color_attachment.initialLayout =
+        resume ? present_layout : VK_IMAGE_LAYOUT_UNDEFINED;
+    color_attachment.finalLayout = present_layout;
+
+    VkAttachmentDescription &depth_attachment = attachments[1];
+    depth_attachment = color_attachment;
+    depth_attachment.format = depth_pyramid.depth_format;
+    depth_attachment.storeOp = store_depth ? VK_ATTACHMENT_STORE_OP_STORE
+                                           : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depth_attachment.initialLayout =
+        resume ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+               : VK_IMAGE_LAYOUT_UNDEFINED;
+    depth_attachment.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
     VkAttachmentReference color_attachment_ref = {};
     color_attachment_ref.attachment = 0;
     color_attachment_ref.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
+    VkAttachmentReference depth_attachment_ref = {};
+    depth_attachment_ref.attachment = 1;
+    depth_attachment_ref.layout =
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
     VkSubpassDescription subpass = {};
     subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
     subpass.colorAttachmentCount = 1;
     subpass.pColorAttachments = &color_attachment_ref;
-
-    VkSubpassDependency dependency = {};
-    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-    dependency.dstSubpass = 0;
-    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.srcAccessMask = 0;
-    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
-                               VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    subpass.pDepthStencilAttachment = &depth_attachment_ref;
+
+    // Waits for the color and depth writes of the previous pass, and for
+    // the pyramid build reading the depth
+    std::array<VkSubpassDependency, 2> dependencies = {};
+    dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[0].dstSubpass = 0;
+    dependencies[0].srcStageMask =
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+        VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT |
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    dependencies[0].srcAccessMask =
+        VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    dependencies[0].dstStageMask =
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+        VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+        VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    dependencies[0].dstAccessMask =
+        VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+        VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+    // The pyramid build samples the depth once the pass is over
+    dependencies[1].srcSubpass = 0;
+    dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[1].srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    dependencies[1].srcAccessMask =
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    dependencies[1].dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
 
     VkRenderPassCreateInfo render_pass_info = {};
     render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-    render_pass_info.attachmentCount = 1;
-    render_pass_info.pAttachments = &color_attachment;
+    render_pass_info.attachmentCount = attachments.size();
+    render_pass_info.pAttachments = attachments.data();
     render_pass_info.subpassCount = 1;
     render_pass_info.pSubpasses = &subpass;
-    render_pass_info.dependencyCount = 1;
-    render_pass_info.pDependencies = &dependency;
+    render_pass_info.dependencyCount = dependencies.size();
+    render_pass_info.pDependencies = dependencies.data();
 
-    CHECK_VK(bootstrap.dispatch.createRenderPass(&render_pass_info, nullptr,
-                                                 &render_pass));
+    VkRenderPass pass;
+    CHECK_VK(
+        bootstrap.dispatch.createRenderPass(&render_pass_info, nullptr, &pass));
+    return pass;
   }
 
-  void init_graphics_pipeline(BootstrapInfo &bootstrap) {
-    auto vert = create_shader_module(bootstrap, "./build/shader.vert.spv");
-    auto frag = create_shader_module(bootstrap, "./build/shader.frag.spv");
-
-    VkPipelineShaderStageCreateInfo vert_stage_info = {};
-    vert_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    vert_stage_info.stage = VK_SHADER_STAGE_VERTEX_BIT;
-    vert_stage_info.module = vert;
-    vert_stage_info.pName = "main";
-
-    VkPipelineShaderStageCreateInfo frag_stage_info = {};
-    frag_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    frag_stage_info.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-    frag_stage_info.module = frag;
-    frag_stage_info.pName = "main";
-
-    VkPipelineShaderStageCreateInfo shader_stages[] = {vert_stage_info,
-                                                       frag_stage_info};
-
-    auto binding_description = Vertex::binding_description();
-    auto attribute_descriptions = Vertex::attribute_descriptions();
-
-    VkPipelineVertexInputStateCreateInfo vertex_input_info = {};
-    vertex_input_info.sType =
-        VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-
-    vertex_input_info.vertexBindingDescriptionCount = 1;
-    vertex_input_info.vertexAttributeDescriptionCount =
-        attribute_descriptions.size();
-    vertex_input_info.pVertexBindingDescriptions = &binding_description;
-    vertex_input_info.pVertexAttributeDescriptions =
-        attribute_descriptions.data();
-
-    VkPipelineInputAssemblyStateCreateInfo input_assembly = {};
-    input_assembly.sType =
-        VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-    input_assembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-    input_assembly.primitiveRestartEnable = VK_FALSE;
-
-    VkViewport viewport = {};
-    viewport.x = 0.0f;
-    viewport.y = 0.0f;
-    viewport.width = (float)bootstrap.swapchain.extent.width;
-    viewport.height = (float)bootstrap.swapchain.extent.height;
-    viewport.minDepth = 0.0f;
-    viewport.maxDepth = 1.0f;
-
-    VkRect2D scissor = {};
-    scissor.offset = {0, 0};
-    scissor.extent = bootstrap.swapchain.extent;
-
-    VkPipelineViewportStateCreateInfo viewport_state = {};
-    viewport_state.sType =
-        VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-    viewport_state.viewportCount = 1;
-    viewport_state.pViewports = &viewport;
-    viewport_state.scissorCount = 1;
-    viewport_state.pScissors = &scissor;
-
-    VkPipelineRasterizationStateCreateInfo rasterizer = {};
-    rasterizer.sType =
-        VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-    rasterizer.depthClampEnable = VK_FALSE;
-    rasterizer.rasterizerDiscardEnable = VK_FALSE;
-    rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
-    rasterizer.lineWidth = 1.0f;
-    rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-    rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
-    rasterizer.depthBiasEnable = VK_FALSE;
-
-    VkPipelineMultisampleStateCreateInfo multisampling = {};
-    multisampling.sType =
-        VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-    multisampling.sampleShadingEnable = VK_FALSE;
-    multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-
-    VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
-    colorBlendAttachment.colorWriteMask =
-        VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
-        VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-    colorBlendAttachment.blendEnable = VK_FALSE;
-
-    VkPipelineColorBlendStateCreateInfo color_blending = {};
-    color_blending.sType =
-        VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-    color_blending.logicOpEnable = VK_FALSE;
-    color_blending.logicOp = VK_LOGIC_OP_COPY;
-    color_blending.attachmentCount = 1;
-    color_blending.pAttachments = &colorBlendAttachment;
-    color_blending.blendConstants[0] = 0.0f;
-    color_blending.blendConstants[1] = 0.0f;
-    color_blending.blendConstants[2] = 0.0f;
-    color_blending.blendConstants[3] = 0.0f;
+  void init_render_pass(BootstrapInfo &bootstrap) {
+    render_pass = create_render_pass(bootstrap, false, false);
+    early_render_pass = create_render_pass(bootstrap, false, true);
+    resume_render_pass = create_render_pass(bootstrap, true, false);
+  }
 
+  void init_graphics_pipeline(BootstrapInfo &bootstrap) {
     VkPipelineLayoutCreateInfo pipeline_layout_info = {};
     pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipeline_layout_info.setLayoutCount = 0;
-    pipeline_layout_info.pushConstantRangeCount = 0;
+    VkPushConstantRange push_range = {};
+    push_range.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    push_range.size = sizeof(DrawPushConstants);
+
+    std::array<VkDescriptorSetLayout, 2> set_layouts = {
+        frame_ring.set_layout, bindless.set_layout};
+    pipeline_layout_info.setLayoutCount = set_layouts.size();
+    pipeline_layout_info.pSetLayouts = set_layouts.data();
+    pipeline_layout_info.pushConstantRangeCount = 1;
+    pipeline_layout_info.pPushConstantRanges = &push_range;
 
     CHECK_VK(bootstrap.dispatch.createPipelineLayout(&pipeline_layout_info,
                                                      NULL, &pipeline_layout));
-    std::vector<VkDynamicState> dynamic_states = {
-        VK_DYNAMIC_STATE_VIEWPORT,
-        VK_DYNAMIC_STATE_SCISSOR,
-    };
 
-    VkPipelineDynamicStateCreateInfo dynamic_info = {};
-    dynamic_info.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-    dynamic_info.dynamicStateCount =
-        static_cast<uint32_t>(dynamic_states.size());
-    dynamic_info.pDynamicStates = dynamic_states.data();
-
-    VkGraphicsPipelineCreateInfo pipeline_info = {};
-    pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-    pipeline_info.stageCount = 2;
-    pipeline_info.pStages = shader_stages;
-    pipeline_info.pVertexInputState = &vertex_input_info;
-    pipeline_info.pInputAssemblyState = &input_assembly;
-    pipeline_info.pViewportState = &viewport_state;
-    pipeline_info.pRasterizationState = &rasterizer;
-    pipeline_info.pMultisampleState = &multisampling;
-    pipeline_info.pColorBlendState = &color_blending;
-    pipeline_info.pDynamicState = &dynamic_info;
-    pipeline_info.layout = pipeline_layout;
-    pipeline_info.renderPass = render_pass;
-    pipeline_info.subpass = 0;
-    pipeline_info.basePipelineHandle = VK_NULL_HANDLE;
-
-    // TODO: add pipeline caching
-    CHECK_VK(bootstrap.dispatch.createGraphicsPipelines(
-        VK_NULL_HANDLE, 1, &pipeline_info, NULL, &pipeline));
-
-    bootstrap.dispatch.destroyShaderModule(vert, NULL);
-    bootstrap.dispatch.destroyShaderModule(frag, NULL);
+    auto attribute_descriptions =
+        VertexLayout<PackedVertex>::attribute_descriptions();
+
+    GraphicsPipelineDesc desc;
+    desc.name = "scene";
+    desc.vert_shader = "shader.vert";
+    desc.frag_shader = "shader.frag";
+    desc.bindings = {VertexLayout<PackedVertex>::binding_description()};
+    desc.attributes = {attribute_descriptions.begin(),
+                       attribute_descriptions.end()};
+    desc.layout = pipeline_layout;
+    desc.render_pass = render_pass;
+    desc.subpass = 0;
+
+    // Compiled in the background, the scene is drawn once it is ready
+    scene_pipeline = pipelines.compile(bootstrap, desc);
+
+    // Instance attributes follow the vertex ones
+    auto instance_attributes = VertexLayout<Instance>::attribute_descriptions(
+        1, attribute_descriptions.size());
+
+    desc.name = "instanced";
+    desc.vert_shader = "instanced.vert";
+    desc.bindings.push_back(VertexLayout<Instance>::binding_description(
+        1, VK_VERTEX_INPUT_RATE_INSTANCE));
+    desc.attributes.insert(desc.attributes.end(), instance_attributes.begin(),
+                           instance_attributes.end());
+    instanced_pipeline = pipelines.compile(bootstrap, desc);
+  }
+
+  void create_offscreen_image(BootstrapInfo &bootstrap, FrameData &frame_data) {
+    VkImageCreateInfo image_info = {};
+    image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    image_info.imageType = VK_IMAGE_TYPE_2D;
+    image_info.format = bootstrap.image_format();
+    image_info.extent = {bootstrap.extent().width, bootstrap.extent().height,
+                         1};
+    image_info.mipLevels = 1;
+    image_info.arrayLayers = 1;
+    image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+    image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    image_info.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                       VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    VmaAllocationCreateInfo vmalloc_info = {};
+    vmalloc_info.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+
+    CHECK_VK(vmaCreateImage(bootstrap.allocator, &image_info, &vmalloc_info,
+                            &frame_data.image, &frame_data.image_allocation,
+                            nullptr));
+
+    VkImageViewCreateInfo view_info = {};
+    view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    view_info.image = frame_data.image;
+    view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    view_info.format = bootstrap.image_format();
+    view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    view_info.subresourceRange.levelCount = 1;
+    view_info.subresourceRange.layerCount = 1;
+
+    CHECK_VK(bootstrap.dispatch.createImageView(&view_info, NULL,
+                                                &frame_data.image_view));
   }
 
   void init_frame_data(BootstrapInfo &bootstrap) {
     frames.clear();
-    frames.resize(bootstrap.swapchain.image_count);
+    frames.resize(bootstrap.image_count());
 
-    auto images = bootstrap.swapchain.get_images().value();
-    auto image_views = bootstrap.swapchain.get_image_views().value();
+    std::vector<VkImage> images;
+    std::vector<VkImageView> image_views;
+    if (!bootstrap.headless) {
+      images = bootstrap.swapchain.get_images().value();
+      image_views = bootstrap.swapchain.get_image_views().value();
+    }
 
-    for (size_t i = 0; i < bootstrap.swapchain.image_count; i++) {
+    for (size_t i = 0; i < bootstrap.image_count(); i++) {
       FrameData frame_data;
 
-      frame_data.swapchain_image = images[i];
-      frame_data.swapchain_image_view = image_views[i];
+      if (bootstrap.headless) {
+        create_offscreen_image(bootstrap, frame_data);
+      } else {
+        frame_data.image = images[i];
+        frame_data.image_view = image_views[i];
+      }
 
+      // Every frame shares the depth target
+      std::array<VkImageView, 2> attachments = {
+          frame_data.image_view, depth_pyramid.targets.depth_view};
       VkFramebufferCreateInfo framebuffer_create_info = {};
       framebuffer_create_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
       framebuffer_create_info.renderPass = render_pass;
-      framebuffer_create_info.attachmentCount = 1;
-      framebuffer_create_info.pAttachments = &frame_data.swapchain_image_view;
-      framebuffer_create_info.width = bootstrap.swapchain.extent.width;
-      framebuffer_create_info.height = bootstrap.swapchain.extent.height;
+      framebuffer_create_info.attachmentCount = attachments.size();
+      framebuffer_create_info.pAttachments = attachments.data();
+      framebuffer_create_info.width = bootstrap.extent().width;
+      framebuffer_create_info.height = bootstrap.extent().height;
       framebuffer_create_info.layers = 1;
 
       CHECK_VK(bootstrap.dispatch.createFramebuffer(
@@ -308,6 +417,11 @@ struct RenderData {
         bootstrap.device.get_queue_index(vkb::QueueType::graphics).value();
     pool_create_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
 
+    VkCommandBufferAllocateInfo alloc_info = {};
+    alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    alloc_info.commandBufferCount = FRAME_COMMAND_BUFFERS;
+
     for (size_t i = 0; i < frames_in_flight.size(); i++) {
       FrameInFlight finf;
 
@@ -320,175 +434,482 @@ struct RenderData {
       CHECK_VK(bootstrap.dispatch.createCommandPool(
           &pool_create_info, NULL, &finf.per_frame_command_pool));
 
+      alloc_info.commandPool = finf.per_frame_command_pool;
+      finf.command_buffers.resize(FRAME_COMMAND_BUFFERS);
+      CHECK_VK(bootstrap.dispatch.allocateCommandBuffers(
+          &alloc_info, finf.command_buffers.data()));
+
+      VkCommandBufferAllocateInfo secondary_info = alloc_info;
+      secondary_info.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+      secondary_info.commandBufferCount = 1;
+      CHECK_VK(bootstrap.dispatch.allocateCommandBuffers(
+          &secondary_info, &finf.imgui_command_buffer));
+
       frames_in_flight[i] = finf;
     }
   }
 
-  void init_command_pool(BootstrapInfo &bootstrap) {
-    VkCommandPoolCreateInfo create_info = {};
-    create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-    create_info.queueFamilyIndex =
-        bootstrap.device.get_queue_index(vkb::QueueType::graphics).value();
+  // Begins the next command buffer of the current frame's ring, only
+  // allocates if a frame ever records more than the ring holds
+  VkCommandBuffer begin_frame_command_buffer(BootstrapInfo &bootstrap) {
+    auto &finf = frames_in_flight[current_frame];
+
+    if (finf.command_buffers_used == finf.command_buffers.size()) {
+      VkCommandBufferAllocateInfo alloc_info = {};
+      alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+      alloc_info.commandBufferCount = 1;
+      alloc_info.commandPool = finf.per_frame_command_pool;
+      alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+
+      VkCommandBuffer command_buffer;
+      CHECK_VK(bootstrap.dispatch.allocateCommandBuffers(&alloc_info,
+                                                         &command_buffer));
+      finf.command_buffers.push_back(command_buffer);
+    }
+
+    VkCommandBuffer command_buffer =
+        finf.command_buffers[finf.command_buffers_used++];
+
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    CHECK_VK(
+        bootstrap.dispatch.beginCommandBuffer(command_buffer, &begin_info));
 
-    CHECK_VK(bootstrap.dispatch.createCommandPool(&create_info, NULL,
-                                                  &command_pool));
+    return command_buffer;
   }
 
-  void write_command_buffer(BootstrapInfo &bootstrap) {
-    VkCommandBufferAllocateInfo alloc_info = {};
-    alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    alloc_info.commandPool = command_pool;
-    alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    alloc_info.commandBufferCount = frames.size();
-
-    std::vector<VkCommandBuffer> command_buffers(alloc_info.commandBufferCount);
-    CHECK_VK(bootstrap.dispatch.allocateCommandBuffers(&alloc_info,
-                                                       command_buffers.data()));
-
-    for (uint32_t i = 0; i < command_buffers.size(); i++) {
-      VkCommandBufferBeginInfo begin_info = {};
-      begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-      // XXX: fixes validation layers screaming when resizing, needs further
-      // investigation
-      begin_info.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-
-      CHECK_VK(bootstrap.dispatch.beginCommandBuffer(command_buffers[i],
-                                                     &begin_info));
-
-      VkRenderPassBeginInfo render_pass_info = {};
-      render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-      render_pass_info.renderPass = render_pass;
-      render_pass_info.framebuffer = frames[i].framebuffer;
-      render_pass_info.renderArea.offset = {0, 0};
-      render_pass_info.renderArea.extent = bootstrap.swapchain.extent;
-      VkClearValue clearColor{{{0.0f, 0.0f, 0.0f, 1.0f}}};
-      render_pass_info.clearValueCount = 1;
-      render_pass_info.pClearValues = &clearColor;
-
-      VkViewport viewport = {};
-      viewport.x = 0.0f;
-      viewport.y = 0.0f;
-      viewport.width = (float)bootstrap.swapchain.extent.width;
-      viewport.height = (float)bootstrap.swapchain.extent.height;
-      viewport.minDepth = 0.0f;
-      viewport.maxDepth = 1.0f;
-
-      VkRect2D scissor = {};
-      scissor.offset = {0, 0};
-      scissor.extent = bootstrap.swapchain.extent;
-
-      bootstrap.dispatch.cmdSetViewport(command_buffers[i], 0, 1, &viewport);
-      bootstrap.dispatch.cmdSetScissor(command_buffers[i], 0, 1, &scissor);
-
-      bootstrap.dispatch.cmdBeginRenderPass(
-          command_buffers[i], &render_pass_info, VK_SUBPASS_CONTENTS_INLINE);
-
-      bootstrap.dispatch.cmdBindPipeline(
-          command_buffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
-
-      VkBuffer vertex_buffers[] = {mesh->vert_buffer};
-      VkDeviceSize offsets[] = {0};
-      VkBuffer index_buffers[] = {mesh->index_buffer};
-      bootstrap.dispatch.cmdBindVertexBuffers(command_buffers[i], 0, 1,
-                                              vertex_buffers, offsets);
-      bootstrap.dispatch.cmdBindIndexBuffer(
-          command_buffers[i], mesh->index_buffer, 0, VK_INDEX_TYPE_UINT32);
-
-      bootstrap.dispatch.cmdDrawIndexed(command_buffers[i], INDICES.size(), 1,
-                                        0, 0, 0);
-
-      bootstrap.dispatch.cmdEndRenderPass(command_buffers[i]);
-
-      CHECK_VK(bootstrap.dispatch.endCommandBuffer(command_buffers[i]));
-
-      frames[i].command_buffer = command_buffers[i];
-    }
+  // Every command buffer that was ever allocated for frame recording, stays
+  // flat once the frames have warmed up
+  size_t allocated_command_buffers() const {
+    size_t count = 0;
+    for (auto &finf : frames_in_flight)
+      count += finf.command_buffers.size();
+    for (auto &thread_frame : recorder.thread_frames)
+      count += thread_frame.command_buffers.size();
+    return count;
+  }
+
+  bool parallel_recording() const {
+    return recording_threads > 0 && !gpu_driven;
   }
 
-  void recreate_swapchain(BootstrapInfo &bootstrap) {
+  // Waits for the device to idle, zero records inline
+  void set_recording_threads(BootstrapInfo &bootstrap, uint32_t threads) {
     bootstrap.dispatch.deviceWaitIdle();
-    bootstrap.dispatch.destroyCommandPool(command_pool, nullptr);
+    recorder.destroy(bootstrap);
 
-    std::vector<VkImageView> image_views;
-    for (auto &frame : frames) {
-      bootstrap.dispatch.destroyFramebuffer(frame.framebuffer, nullptr);
-      image_views.push_back(frame.swapchain_image_view);
+    recording_threads = threads;
+    if (parallel_recording())
+      recorder.init(bootstrap, MAX_FRAMES_IN_FLIGHT, recording_threads);
+  }
+
+  bool scene_ready() const {
+    if (gpu_driven)
+      return gpu_scene.is_ready(pipelines);
+    return pipelines.is_ready(scene_pipeline);
+  }
+
+  void cmd_set_viewport(BootstrapInfo &bootstrap,
+                        VkCommandBuffer command_buffer) {
+    VkViewport viewport = {};
+    viewport.x = 0.0f;
+    viewport.y = 0.0f;
+    viewport.width = (float)bootstrap.extent().width;
+    viewport.height = (float)bootstrap.extent().height;
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+
+    VkRect2D scissor = {};
+    scissor.offset = {0, 0};
+    scissor.extent = bootstrap.extent();
+
+    bootstrap.dispatch.cmdSetViewport(command_buffer, 0, 1, &viewport);
+    bootstrap.dispatch.cmdSetScissor(command_buffer, 0, 1, &scissor);
+  }
+
+  // Room for the transforms of the scene draws of the frame being built,
+  // identities unless written between begin_frame and draw_frame
+  glm::mat4 *push_scene_transforms() {
+    if (!scene_transforms)
+      scene_transforms = frame_ring.push_storage<glm::mat4>(
+          scene_draw_count, scene_transform_offset);
+    return scene_transforms;
+  }
+
+  void queue_scene_draws() {
+    scene_depths.resize(scene_draw_count);
+    uint32_t mesh_id = render_queue.add_mesh(*mesh);
+    if (!cpu_culling) {
+      for (uint32_t draw = 0; draw < scene_draw_count; draw++)
+        render_queue.push(0, scene_pipeline, scene_material, mesh_id,
+                          scene_depths[draw], draw);
+      return;
+    }
+
+    CHECK_REPORT_FMT(scene_objects.size() == scene_draw_count,
+                     "Culling needs an object per scene draw, {} for {}",
+                     scene_objects.size(), scene_draw_count);
+    uint32_t visible_count = culler.cull(scene_objects, view_projection);
+    glm::mat4 *transforms = push_scene_transforms();
+    for (uint32_t i = 0; i < visible_count; i++) {
+      uint32_t draw = culler.visible[i];
+      transforms[i] = scene_objects.transforms[draw];
+      render_queue.push(0, scene_pipeline, scene_material, mesh_id,
+                        scene_depths[draw], i);
     }
+  }
 
-    bootstrap.swapchain.destroy_image_views(image_views);
+  // Draws [begin, end) of the sorted render queue, inside of the render pass
+  void cmd_draw_scene(BootstrapInfo &bootstrap, VkCommandBuffer command_buffer,
+                      uint32_t begin, uint32_t end) {
+    frame_ring.cmd_bind(bootstrap, command_buffer,
+                        VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, 0,
+                        frame_uniform_offset, scene_transform_offset);
+    bindless.cmd_bind(bootstrap, command_buffer,
+                      VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, 1);
+    render_queue.cmd_draw(bootstrap, command_buffer, pipelines, pipeline_layout,
+                          begin, end);
+  }
 
-    bootstrap.init_swapchain();
-    init_frame_data(bootstrap);
-    init_command_pool(bootstrap);
-    write_command_buffer(bootstrap);
+  // Draws [begin, end) of the instance batches, inside of the render pass
+  void cmd_draw_instances(BootstrapInfo &bootstrap,
+                          VkCommandBuffer command_buffer, uint32_t begin,
+                          uint32_t end) {
+    bootstrap.dispatch.cmdBindPipeline(command_buffer,
+                                       VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                       pipelines.get(instanced_pipeline));
+    frame_ring.cmd_bind(bootstrap, command_buffer,
+                        VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, 0,
+                        frame_uniform_offset, scene_transform_offset);
+    bindless.cmd_bind(bootstrap, command_buffer,
+                      VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, 1);
+    instances.cmd_draw(bootstrap, command_buffer, begin, end);
   }
 
-  VkCommandBuffer create_imgui_command_buffer(BootstrapInfo &bootstrap,
+  VkCommandBuffer create_scene_command_buffer(BootstrapInfo &bootstrap,
                                               uint32_t image_index) {
-    // Setup the newly allocated
-    VkCommandBuffer command_buffer;
-    VkCommandBufferAllocateInfo alloc_command_buffer_info = {};
-    alloc_command_buffer_info.sType =
-        VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    alloc_command_buffer_info.commandBufferCount = 1;
-    alloc_command_buffer_info.commandPool = command_pool;
-    alloc_command_buffer_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    CHECK_VK(bootstrap.dispatch.allocateCommandBuffers(
-        &alloc_command_buffer_info, &command_buffer));
+    auto record_start = std::chrono::steady_clock::now();
+    VkCommandBuffer command_buffer = begin_frame_command_buffer(bootstrap);
+    bool ready = scene_ready();
+    bool parallel = parallel_recording();
+    render_pass_instances = 0;
+    resumed_render_passes = 0;
+    depth_storing_passes = 0;
+    uint32_t batch_count = instances.batches.size();
+    bool draw_instances =
+        batch_count > 0 && pipelines.is_ready(instanced_pipeline);
+
+    instances.flush(bootstrap);
+
+    frame_uniform_offset = frame_ring.push_uniform(
+        FrameUniforms{.view_projection = view_projection});
+    if (ready && !gpu_driven)
+      queue_scene_draws();
+    if (!gpu_driven && !scene_transforms)
+      std::fill_n(push_scene_transforms(), scene_draw_count, glm::mat4(1.0f));
+    frame_ring.flush(bootstrap);
+
+    render_queue.sort();
+    uint32_t packet_count = gpu_driven ? 0 : render_queue.packets.size();
 
     VkRenderPassBeginInfo render_pass_info = {};
     render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
     render_pass_info.renderPass = render_pass;
     render_pass_info.framebuffer = frames[image_index].framebuffer;
-    render_pass_info.renderArea.extent.width =
-        bootstrap.swapchain.extent.width;
-    render_pass_info.renderArea.extent.height =
-        bootstrap.swapchain.extent.height;
-    VkClearValue clearColor{{{0.0f, 0.0f, 0.0f, 0.0f}}};
-    render_pass_info.clearValueCount = 1;
-    render_pass_info.pClearValues = &clearColor;
-
-    VkCommandBufferBeginInfo command_buffer_begin = {};
-    command_buffer_begin.sType =
-        VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    command_buffer_begin.flags =
-        VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-    CHECK_VK(bootstrap.dispatch.beginCommandBuffer(
-        command_buffer, &command_buffer_begin));
-
-    bootstrap.dispatch.cmdBeginRenderPass(command_buffer,
-                                          &render_pass_info,
-                                          VK_SUBPASS_CONTENTS_INLINE);
-    ImGui::Render();
-    ImDrawData *draw_data = ImGui::GetDrawData();
-    ImGui_ImplVulkan_RenderDrawData(draw_data, command_buffer);
+    render_pass_info.renderArea.offset = {0, 0};
+    render_pass_info.renderArea.extent = bootstrap.extent();
+    std::array<VkClearValue, 2> clear_values = {};
+    clear_values[0].color = {{0.0f, 0.0f, 0.0f, 1.0f}};
+    clear_values[1].depthStencil = {1.0f, 0};
+    render_pass_info.clearValueCount = clear_values.size();
+    render_pass_info.pClearValues = clear_values.data();
+
+    cmd_set_viewport(bootstrap, command_buffer);
+
+    // With occlusion culling what was visible last frame is drawn first, the
+    // pyramid built from its depth culls the rest, drawn in the main pass
+    bool two_phase = false;
+    CullPhase phase = CullPhase::ALL;
+    if (ready && gpu_driven) {
+      depth_pyramid.cmd_initialize(bootstrap, command_buffer);
+      two_phase = occlusion_culling && depth_pyramid.is_ready(pipelines);
+    }
+    if (two_phase) {
+      gpu_scene.cmd_cull(bootstrap, pipelines, command_buffer, view_projection,
+                         CullPhase::EARLY, frame_ring, frame_uniform_offset,
+                         depth_pyramid);
+      render_pass_info.renderPass = early_render_pass;
+      bootstrap.dispatch.cmdBeginRenderPass(command_buffer, &render_pass_info,
+                                            VK_SUBPASS_CONTENTS_INLINE);
+      render_pass_instances++;
+      depth_storing_passes++;
+      gpu_scene.cmd_draw(bootstrap, pipelines, command_buffer, frame_ring,
+                         frame_uniform_offset, bindless, CullPhase::EARLY);
+      bootstrap.dispatch.cmdEndRenderPass(command_buffer);
+
+      {
+        GpuScope hiz_scope(profiler, bootstrap, command_buffer, "hiz");
+        depth_pyramid.cmd_build(bootstrap, pipelines, command_buffer);
+      }
+      render_pass_info.renderPass = resume_render_pass;
+      resumed_render_passes++;
+      phase = CullPhase::LATE;
+    }
+    if (ready && gpu_driven)
+      gpu_scene.cmd_cull(bootstrap, pipelines, command_buffer, view_projection,
+                         phase, frame_ring, frame_uniform_offset,
+                         depth_pyramid);
+
+    bootstrap.dispatch.cmdBeginRenderPass(
+        command_buffer, &render_pass_info,
+        parallel ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
+                 : VK_SUBPASS_CONTENTS_INLINE);
+    render_pass_instances++;
+
+    // Until the pipelines are compiled the pass only clears and draws ImGui
+    if (parallel) {
+      VkCommandBufferInheritanceInfo inheritance = {};
+      inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+      inheritance.renderPass = render_pass;
+      inheritance.subpass = 0;
+      inheritance.framebuffer = frames[image_index].framebuffer;
+
+      auto record_scene = [&](VkCommandBuffer secondary, uint32_t begin,
+                              uint32_t end) {
+        cmd_set_viewport(bootstrap, secondary);
+        cmd_draw_scene(bootstrap, secondary, begin, end);
+      };
+      auto record_instances = [&](VkCommandBuffer secondary, uint32_t begin,
+                                  uint32_t end) {
+        cmd_set_viewport(bootstrap, secondary);
+        cmd_draw_instances(bootstrap, secondary, begin, end);
+      };
+
+      // The secondaries are handed over before the next record reuses the
+      // list
+      if (packet_count > 0) {
+        auto &secondaries =
+            recorder.record(bootstrap, current_frame, inheritance,
+                            packet_count, record_scene);
+        bootstrap.dispatch.cmdExecuteCommands(
+            command_buffer, secondaries.size(), secondaries.data());
+      }
+      if (draw_instances) {
+        auto &secondaries = recorder.record(
+            bootstrap, current_frame, inheritance, batch_count,
+            record_instances);
+        bootstrap.dispatch.cmdExecuteCommands(
+            command_buffer, secondaries.size(), secondaries.data());
+      }
+
+      VkCommandBuffer imgui_command_buffer =
+          record_imgui_secondary(bootstrap, inheritance);
+      bootstrap.dispatch.cmdExecuteCommands(command_buffer, 1,
+                                            &imgui_command_buffer);
+    } else {
+      if (ready && gpu_driven)
+        gpu_scene.cmd_draw(bootstrap, pipelines, command_buffer, frame_ring,
+                           frame_uniform_offset, bindless, phase);
+      else if (packet_count > 0)
+        cmd_draw_scene(bootstrap, command_buffer, 0, packet_count);
+
+      if (draw_instances)
+        cmd_draw_instances(bootstrap, command_buffer, 0, batch_count);
+
+      cmd_draw_imgui(bootstrap, command_buffer);
+    }
+
     bootstrap.dispatch.cmdEndRenderPass(command_buffer);
+    if (ready && gpu_driven)
+      gpu_scene.cmd_read_counts(bootstrap, command_buffer, current_frame,
+                                two_phase);
+    profiler.end_scope(bootstrap, command_buffer, frame_gpu_scope);
+    CHECK_VK(bootstrap.dispatch.endCommandBuffer(command_buffer));
+
+    scene_record_ms = std::chrono::duration<double, std::milli>(
+                          std::chrono::steady_clock::now() - record_start)
+                          .count();
+    return command_buffer;
+  }
+
+  // Replaces the swapchain without waiting for the device, the old one is
+  // destroyed along with its framebuffers and image views once the frames
+  // using them have completed. Returns false while the window is minimized,
+  // there is nothing to present to then.
+  bool recreate_swapchain(BootstrapInfo &bootstrap) {
+    int width = 0, height = 0;
+    glfwGetFramebufferSize(bootstrap.window, &width, &height);
+    if (width == 0 || height == 0)
+      return false;
+
+    std::vector<VkFramebuffer> framebuffers;
+    std::vector<VkImageView> image_views;
+    for (auto &frame : frames) {
+      framebuffers.push_back(frame.framebuffer);
+      image_views.push_back(frame.image_view);
+    }
+    vkb::Swapchain old_swapchain = bootstrap.replace_swapchain();
+    bootstrap.deletion_queue.push([&bootstrap, old_swapchain, framebuffers,
+                                   image_views]() mutable {
+      for (auto framebuffer : framebuffers)
+        bootstrap.dispatch.destroyFramebuffer(framebuffer, nullptr);
+      old_swapchain.destroy_image_views(image_views);
+      vkb::destroy_swapchain(old_swapchain);
+    });
+    swapchain_recreations++;
+
+    depth_pyramid.recreate(bootstrap);
+    init_frame_data(bootstrap);
+    return true;
+  }
+
+  // Draws ImGui over the scene in the same render pass instance, so the
+  // target is cleared and stored once per frame
+  void cmd_draw_imgui(BootstrapInfo &bootstrap,
+                      VkCommandBuffer command_buffer) {
+    profiler.end_scope(bootstrap, command_buffer, scene_gpu_scope);
+
+    GpuScope imgui_scope(profiler, bootstrap, command_buffer, "imgui");
+    ImGui::Render();
+    ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), command_buffer);
+  }
+
+  // A pass executing secondaries cannot take inline commands, ImGui is
+  // recorded into a secondary of its own on this thread
+  VkCommandBuffer
+  record_imgui_secondary(BootstrapInfo &bootstrap,
+                         const VkCommandBufferInheritanceInfo &inheritance) {
+    VkCommandBuffer command_buffer =
+        frames_in_flight[current_frame].imgui_command_buffer;
+
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+                       VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    begin_info.pInheritanceInfo = &inheritance;
+    CHECK_VK(
+        bootstrap.dispatch.beginCommandBuffer(command_buffer, &begin_info));
+
+    cmd_draw_imgui(bootstrap, command_buffer);
+
+    CHECK_VK(bootstrap.dispatch.endCommandBuffer(command_buffer));
+    return command_buffer;
+  }
+
+  VkCommandBuffer create_frame_begin_command_buffer(BootstrapInfo &bootstrap) {
+    VkCommandBuffer command_buffer = begin_frame_command_buffer(bootstrap);
+
+    profiler.cmd_reset(bootstrap, command_buffer);
+    frame_gpu_scope = profiler.begin_scope(bootstrap, command_buffer, "frame");
+    scene_gpu_scope = profiler.begin_scope(bootstrap, command_buffer, "scene");
 
     CHECK_VK(bootstrap.dispatch.endCommandBuffer(command_buffer));
 
     return command_buffer;
   }
 
+  // Applied with a swapchain recreation, frames keep rendering meanwhile
+  void set_present_mode(BootstrapInfo &bootstrap,
+                        VkPresentModeKHR present_mode) {
+    bootstrap.present_mode = present_mode;
+    if (!bootstrap.headless)
+      recreate_swapchain(bootstrap);
+  }
+
+  // Called right before input is sampled. Sleeps for the frame rate cap and,
+  // in low latency mode, begins the frame so the wait for the GPU happens
+  // before input rather than after it.
+  void pace_frame(BootstrapInfo &bootstrap) {
+    pacer.wait_for_cap();
+    if (pacer.low_latency && !frame_begun)
+      begin_frame(bootstrap);
+    pacer.input_sampled();
+  }
+
+  // Waits until the resources of the next frame in flight can be written,
+  // instances have to be pushed after this. Called by draw_frame otherwise.
+  void begin_frame(BootstrapInfo &bootstrap) {
+    // Frames that already finished count towards the latency now rather than
+    // when their slot comes around again
+    for (uint32_t i = 0; i < frames_in_flight.size(); i++)
+      if (pacer.has_pending(i) &&
+          bootstrap.dispatch.getFenceStatus(
+              frames_in_flight[i].in_flight_fence) == VK_SUCCESS)
+        pacer.frame_completed(i);
+
+    // Low latency drains every frame in flight, so nothing is queued ahead of
+    // the frame about to be built
+    if (pacer.low_latency) {
+      for (uint32_t i = 0; i < frames_in_flight.size(); i++) {
+        CHECK_VK(bootstrap.dispatch.waitForFences(
+            1, &frames_in_flight[i].in_flight_fence, VK_TRUE, UINT64_MAX));
+        pacer.frame_completed(i);
+      }
+    } else {
+      CHECK_VK(bootstrap.dispatch.waitForFences(
+          1, &frames_in_flight[current_frame].in_flight_fence, VK_TRUE,
+          UINT64_MAX));
+      pacer.frame_completed(current_frame);
+    }
+
+    // With this frame's fence signalled every frame up to
+    // frame_index - MAX_FRAMES_IN_FLIGHT has completed
+    uint64_t completed_frames = frame_index + 1 >= MAX_FRAMES_IN_FLIGHT
+                                    ? frame_index + 1 - MAX_FRAMES_IN_FLIGHT
+                                    : 0;
+    bootstrap.collect_garbage(completed_frames);
+    bootstrap.deletion_queue.frame = frame_index;
+
+    // Also refreshes the budgets VMA reports. The index is truncated on
+    // purpose, it wraps around after 2^32 frames.
+    vmaSetCurrentFrameIndex(bootstrap.allocator, (uint32_t)frame_index);
+    memory.update(bootstrap);
+
+    profiler.begin_frame(bootstrap, current_frame);
+    // The counts of the frame that used this slot are read back by now
+    if (gpu_driven)
+      gpu_scene.begin_frame(bootstrap, current_frame,
+                            profiler.enabled() ? profiler.latest_ms("scene")
+                                               : -1.0f);
+    instances.begin_frame(current_frame);
+    frame_ring.begin_frame(current_frame);
+    bindless.begin_frame(bootstrap, current_frame);
+    render_queue.begin_frame();
+    scene_transforms = nullptr;
+    frame_begun = true;
+  }
+
   void draw_frame(BootstrapInfo &bootstrap) {
-    CHECK_VK(bootstrap.dispatch.waitForFences(
-        1, &frames_in_flight[current_frame].in_flight_fence, VK_TRUE,
-        UINT64_MAX));
+    if (!frame_begun)
+      begin_frame(bootstrap);
+    frame_begun = false;
 
     uint32_t image_index = 0;
-    VkResult result = bootstrap.dispatch.acquireNextImageKHR(
-        bootstrap.swapchain, UINT64_MAX,
-        frames_in_flight[current_frame].available_semaphore, VK_NULL_HANDLE,
-        &image_index);
-
-    if (result != VK_SUBOPTIMAL_KHR) {
-      if (result == VK_ERROR_OUT_OF_DATE_KHR) {
-        recreate_swapchain(bootstrap);
-        return;
-      } else {
-        CHECK_VK(result);
-      }
+    VkResult result = VK_SUCCESS;
+    if (bootstrap.headless) {
+      image_index = frame_index % frames.size();
+    } else {
+      auto acquire = [&]() {
+        return bootstrap.dispatch.acquireNextImageKHR(
+            bootstrap.swapchain, UINT64_MAX,
+            frames_in_flight[current_frame].available_semaphore,
+            VK_NULL_HANDLE, &image_index);
+      };
+
+      // A failed acquire leaves the semaphore unsignaled, the frame goes on
+      // with the new swapchain
+      result = acquire();
+      if (result == VK_ERROR_OUT_OF_DATE_KHR && recreate_swapchain(bootstrap))
+        result = acquire();
     }
 
+    // Minimized, or resized again in between
+    if (result == VK_ERROR_OUT_OF_DATE_KHR)
+      return;
+    if (result != VK_SUBOPTIMAL_KHR)
+      CHECK_VK(result);
+
     if (frames[image_index].image_in_flight != VK_NULL_HANDLE) {
       CHECK_VK(bootstrap.dispatch.waitForFences(
           1, &frames[image_index].image_in_flight, VK_TRUE, UINT64_MAX));
@@ -500,16 +921,20 @@ struct RenderData {
     CHECK_VK(bootstrap.dispatch.resetFences(
         1, &frames_in_flight[current_frame].in_flight_fence));
 
-    // Reset the old per-frame command buffer, ready for rerecording
+    // The frame's command buffers are done, their memory is kept around for
+    // recording this frame
     CHECK_VK(bootstrap.dispatch.resetCommandPool(
-        frames_in_flight[current_frame].per_frame_command_pool,
-        VK_COMMAND_POOL_RESET_RELEASE_RESOURCES_BIT));
-
-    VkCommandBuffer imgui_command_buffer =
-        create_imgui_command_buffer(bootstrap, image_index);
-
-    VkCommandBuffer command_buffers[2] = {frames[image_index].command_buffer,
-                                          imgui_command_buffer};
+        frames_in_flight[current_frame].per_frame_command_pool, 0));
+    frames_in_flight[current_frame].command_buffers_used = 0;
+    if (parallel_recording())
+      recorder.begin_frame(bootstrap, current_frame);
+
+    auto &command_buffers = submit_command_buffers;
+    command_buffers.clear();
+    if (profiler.enabled())
+      command_buffers.push_back(create_frame_begin_command_buffer(bootstrap));
+    command_buffers.push_back(
+        create_scene_command_buffer(bootstrap, image_index));
 
     VkPipelineStageFlags wait_stages[] = {
         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
@@ -517,21 +942,32 @@ struct RenderData {
     VkSubmitInfo submit_info = {};
     submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-    submit_info.waitSemaphoreCount = 1;
-    submit_info.pWaitSemaphores =
-        &frames_in_flight[current_frame].available_semaphore;
-    submit_info.pWaitDstStageMask = wait_stages;
-
-    submit_info.signalSemaphoreCount = 1;
-    submit_info.pSignalSemaphores =
-        &frames_in_flight[current_frame].finished_semaphore;
+    // Offscreen images are not acquired nor presented, so there is nothing to
+    // synchronize with besides the in-flight fence
+    if (!bootstrap.headless) {
+      submit_info.waitSemaphoreCount = 1;
+      submit_info.pWaitSemaphores =
+          &frames_in_flight[current_frame].available_semaphore;
+      submit_info.pWaitDstStageMask = wait_stages;
+
+      submit_info.signalSemaphoreCount = 1;
+      submit_info.pSignalSemaphores =
+          &frames_in_flight[current_frame].finished_semaphore;
+    }
 
-    submit_info.commandBufferCount = 2;
-    submit_info.pCommandBuffers = command_buffers;
+    submit_info.commandBufferCount = command_buffers.size();
+    submit_info.pCommandBuffers = command_buffers.data();
 
     CHECK_VK(bootstrap.dispatch.queueSubmit(
         graphics_queue, 1, &submit_info,
         frames_in_flight[current_frame].in_flight_fence));
+    pacer.frame_submitted(current_frame);
+
+    if (bootstrap.headless) {
+      current_frame = (current_frame + 1) % MAX_FRAMES_IN_FLIGHT;
+      frame_index++;
+      return;
+    }
 
     VkPresentInfoKHR present_info = {};
     present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -548,14 +984,15 @@ struct RenderData {
 
     result = bootstrap.dispatch.queuePresentKHR(present_queue, &present_info);
 
-    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
+    // The frame was submitted either way, so it advances before the swapchain
+    // is replaced
+    current_frame = (current_frame + 1) % MAX_FRAMES_IN_FLIGHT;
+    frame_index++;
+
+    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR)
       recreate_swapchain(bootstrap);
-      return;
-    } else {
+    else
       CHECK_VK(result);
-    }
-
-    current_frame = (current_frame + 1) % MAX_FRAMES_IN_FLIGHT;
   }
 
   void init_imgui(BootstrapInfo &bootstrap) {
@@ -580,7 +1017,11 @@ struct RenderData {
     CHECK_VK(vkCreateDescriptorPool(bootstrap.device, &pool_info, NULL,
                                     &imgui_descriptor_pool));
 
-    ImGui_ImplGlfw_InitForVulkan(bootstrap.window, true);
+    if (bootstrap.headless)
+      io.DisplaySize = ImVec2((float)bootstrap.extent().width,
+                              (float)bootstrap.extent().height);
+    else
+      ImGui_ImplGlfw_InitForVulkan(bootstrap.window, true);
     ImGui_ImplVulkan_InitInfo init_info = {};
     init_info.Instance = bootstrap.instance;
     init_info.PhysicalDevice = bootstrap.physical_device;
@@ -588,12 +1029,14 @@ struct RenderData {
     init_info.Queue = graphics_queue;
     init_info.QueueFamily =
         bootstrap.device.get_queue_index(vkb::QueueType::graphics).value();
-    init_info.PipelineCache = VK_NULL_HANDLE;
+    init_info.PipelineCache = bootstrap.pipeline_cache.cache;
     init_info.DescriptorPool = imgui_descriptor_pool;
     init_info.RenderPass = render_pass;
     init_info.Subpass = 0;
-    init_info.MinImageCount = bootstrap.swapchain.requested_min_image_count;
-    init_info.ImageCount = bootstrap.swapchain.image_count;
+    init_info.MinImageCount =
+        bootstrap.headless ? bootstrap.image_count()
+                           : bootstrap.swapchain.requested_min_image_count;
+    init_info.ImageCount = bootstrap.image_count();
     init_info.MSAASamples = VK_SAMPLE_COUNT_1_BIT;
     init_info.Allocator = nullptr;
     init_info.CheckVkResultFn = nullptr;
@@ -601,12 +1044,38 @@ struct RenderData {
   }
 
   void init(BootstrapInfo &bootstrap) {
+    CHECK_REPORT_STR(MAX_FRAMES_IN_FLIGHT > 0,
+                     "At least one frame has to be in flight");
+
     init_queues(bootstrap);
+    pipelines.init();
+    depth_pyramid.init(bootstrap, pipelines);
     init_render_pass(bootstrap);
+
+    // The transforms of every scene draw are bound as a single array
+    VkDeviceSize transforms_size = sizeof(glm::mat4) * scene_draw_count;
+    frame_ring.storage_range =
+        std::max(frame_ring.storage_range, transforms_size);
+    frame_ring.capacity =
+        std::max(frame_ring.capacity, transforms_size + (1 << 20));
+    frame_ring.init(bootstrap, MAX_FRAMES_IN_FLIGHT);
+    bindless.init(bootstrap, MAX_FRAMES_IN_FLIGHT);
     init_graphics_pipeline(bootstrap);
+    if (gpu_driven)
+      gpu_scene.init(bootstrap, pipelines, render_pass, frame_ring.set_layout,
+                     bindless.set_layout, depth_pyramid.cull_set_layout,
+                     MAX_FRAMES_IN_FLIGHT);
     init_frame_data(bootstrap);
     init_frames_in_flight(bootstrap);
-    init_command_pool(bootstrap);
+    pacer.init(MAX_FRAMES_IN_FLIGHT);
+    memory.init(bootstrap);
+    profiler.init(bootstrap, MAX_FRAMES_IN_FLIGHT);
+    instances.init(bootstrap, MAX_FRAMES_IN_FLIGHT);
+    if (parallel_recording())
+      recorder.init(bootstrap, MAX_FRAMES_IN_FLIGHT, recording_threads);
+    if (cpu_culling)
+      culler.init(culling_threads);
+    render_queue.init(sorting_threads);
     init_imgui(bootstrap);
   }
 };
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <string>
+#include <vector>
+
+namespace b::engine {
+
+// Recent timings of a named scope, GPU profiler scopes and CPU side latency
+struct ScopeStats {
+  static constexpr size_t HISTORY = 128;
+
+  std::string name;
+  // Ring buffer of the most recent timings, in milliseconds
+  std::array<float, HISTORY> history = {};
+  size_t history_head = 0;
+  size_t history_size = 0;
+  float latest_ms = 0.0f;
+  // Every timing since startup, only filled when the profiler records samples
+  std::vector<float> samples;
+
+  void push(float ms, bool record) {
+    latest_ms = ms;
+    history[history_head] = ms;
+    history_head = (history_head + 1) % HISTORY;
+    history_size = std::min(history_size + 1, HISTORY);
+    if (record)
+      samples.push_back(ms);
+  }
+
+  float average_ms() const {
+    if (history_size == 0)
+      return 0.0f;
+
+    float sum = 0.0f;
+    for (size_t i = 0; i < history_size; i++)
+      sum += history[i];
+    return sum / history_size;
+  }
+
+  // Recorded samples if any, otherwise the history oldest first
+  std::vector<float> ordered_samples() const {
+    if (!samples.empty())
+      return samples;
+
+    std::vector<float> ordered;
+    size_t start = (history_head + HISTORY - history_size) % HISTORY;
+    for (size_t i = 0; i < history_size; i++)
+      ordered.push_back(history[(start + i) % HISTORY]);
+    return ordered;
+  }
+};
+
+} // namespace b::engine
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+namespace b::engine {
+
+// SPIR-V of a shader, referred to by its source file name, e.g. "shader.vert"
+struct ShaderCode {
+  const uint32_t *code = nullptr;
+  // In bytes
+  size_t size = 0;
+};
+
+struct EmbeddedShader {
+  const char *name;
+  const uint32_t *code;
+  size_t size;
+};
+
+} // namespace b::engine
+
+// Generated by CMakeLists.txt from src/shaders, defines EMBEDDED_SHADERS
+#include <embedded_shaders.hpp>
+
+namespace b::engine {
+
+inline ShaderCode find_embedded_shader(const char *name) {
+  for (const auto &shader : EMBEDDED_SHADERS)
+    if (std::strcmp(shader.name, name) == 0)
+      return {shader.code, shader.size};
+  return {};
+}
+
+// Reads <dir>/<name>.spv into `storage`, so shaders can be iterated on
+// without rebuilding. Returns false if there is no such file.
+inline bool load_shader_override(const char *dir, const char *name,
+                                 std::vector<uint32_t> &storage,
+                                 ShaderCode &code) {
+  std::string path = std::string(dir) + "/" + name + ".spv";
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  if (!file)
+    return false;
+
+  std::streamsize size = file.tellg();
+  if (size <= 0 || size % sizeof(uint32_t) != 0) {
+    spdlog::warn("Ignoring {}, not a SPIR-V binary", path);
+    return false;
+  }
+
+  file.seekg(0, std::ios::beg);
+  storage.resize(size / sizeof(uint32_t));
+  if (!file.read((char *)storage.data(), size)) {
+    spdlog::warn("Failed to read {}", path);
+    return false;
+  }
+
+  spdlog::info("Using the shader override {}", path);
+  code = {storage.data(), (size_t)size};
+  return true;
+}
+
+} // namespace b::engine
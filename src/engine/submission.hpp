@@ -0,0 +1,194 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+
+#include <VkBootstrap.h>
+#include <vulkan/vulkan.h>
+
+#include "utils/utils.hpp"
+
+namespace b::engine {
+
+// Completion point of a submission, the work is done once the timeline
+// semaphore reaches the value
+struct SubmitTicket {
+  VkSemaphore timeline = VK_NULL_HANDLE;
+  uint64_t value = 0;
+
+  bool valid() const { return timeline != VK_NULL_HANDLE; }
+};
+
+// Batches command buffers recorded for a single queue into one submission,
+// signalling a timeline semaphore instead of waiting for the queue to idle.
+// Command buffers are recycled once the semaphore shows they completed.
+struct QueueSubmitter {
+  struct InFlight {
+    VkCommandBuffer command_buffer;
+    uint64_t value;
+  };
+
+  VkQueue queue = VK_NULL_HANDLE;
+  VkCommandPool command_pool = VK_NULL_HANDLE;
+  VkSemaphore timeline = VK_NULL_HANDLE;
+  // Value signalled by the most recent submission
+  uint64_t submitted_value = 0;
+
+  std::deque<InFlight> in_flight;
+  std::vector<VkCommandBuffer> free_command_buffers;
+
+  std::vector<VkCommandBuffer> batch;
+  std::vector<VkSemaphore> batch_wait_semaphores;
+  std::vector<uint64_t> batch_wait_values;
+  std::vector<VkPipelineStageFlags> batch_wait_stages;
+
+  void init(vkb::DispatchTable &dispatch, VkQueue submit_queue,
+            uint32_t queue_family) {
+    queue = submit_queue;
+
+    VkCommandPoolCreateInfo pool_info = {};
+    pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT |
+                      VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    pool_info.queueFamilyIndex = queue_family;
+    CHECK_VK(dispatch.createCommandPool(&pool_info, NULL, &command_pool));
+
+    VkSemaphoreTypeCreateInfo type_info = {};
+    type_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    type_info.initialValue = 0;
+
+    VkSemaphoreCreateInfo semaphore_info = {};
+    semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphore_info.pNext = &type_info;
+    CHECK_VK(dispatch.createSemaphore(&semaphore_info, NULL, &timeline));
+  }
+
+  uint64_t completed_value(vkb::DispatchTable &dispatch) {
+    uint64_t value = 0;
+    CHECK_VK(dispatch.getSemaphoreCounterValue(timeline, &value));
+    return value;
+  }
+
+  void recycle(vkb::DispatchTable &dispatch) {
+    if (in_flight.empty())
+      return;
+
+    uint64_t completed = completed_value(dispatch);
+    while (!in_flight.empty() && in_flight.front().value <= completed) {
+      VkCommandBuffer command_buffer = in_flight.front().command_buffer;
+      CHECK_VK(dispatch.resetCommandBuffer(command_buffer, 0));
+      free_command_buffers.push_back(command_buffer);
+      in_flight.pop_front();
+    }
+  }
+
+  VkCommandBuffer acquire_command_buffer(vkb::DispatchTable &dispatch) {
+    recycle(dispatch);
+
+    if (!free_command_buffers.empty()) {
+      VkCommandBuffer command_buffer = free_command_buffers.back();
+      free_command_buffers.pop_back();
+      return command_buffer;
+    }
+
+    VkCommandBufferAllocateInfo alloc_info = {};
+    alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    alloc_info.commandPool = command_pool;
+    alloc_info.commandBufferCount = 1;
+
+    VkCommandBuffer command_buffer;
+    CHECK_VK(dispatch.allocateCommandBuffers(&alloc_info, &command_buffer));
+    return command_buffer;
+  }
+
+  // Records into the pending batch, the ticket completes with the batch's
+  // submission
+  template <typename F>
+  SubmitTicket record(vkb::DispatchTable &dispatch, F record) {
+    VkCommandBuffer command_buffer = acquire_command_buffer(dispatch);
+
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    CHECK_VK(dispatch.beginCommandBuffer(command_buffer, &begin_info));
+    CHECK_VK(record(command_buffer));
+    CHECK_VK(dispatch.endCommandBuffer(command_buffer));
+
+    batch.push_back(command_buffer);
+    return {timeline, submitted_value + 1};
+  }
+
+  // The pending batch will not start the given stages before the ticket,
+  // possibly from another queue, completes
+  void wait_before_next_submit(SubmitTicket ticket,
+                               VkPipelineStageFlags stages) {
+    if (!ticket.valid())
+      return;
+
+    batch_wait_semaphores.push_back(ticket.timeline);
+    batch_wait_values.push_back(ticket.value);
+    batch_wait_stages.push_back(stages);
+  }
+
+  SubmitTicket submit(vkb::DispatchTable &dispatch) {
+    if (batch.empty() && batch_wait_semaphores.empty())
+      return {timeline, submitted_value};
+
+    uint64_t signal_value = submitted_value + 1;
+
+    VkTimelineSemaphoreSubmitInfo timeline_info = {};
+    timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timeline_info.waitSemaphoreValueCount = batch_wait_values.size();
+    timeline_info.pWaitSemaphoreValues = batch_wait_values.data();
+    timeline_info.signalSemaphoreValueCount = 1;
+    timeline_info.pSignalSemaphoreValues = &signal_value;
+
+    VkSubmitInfo submit_info = {};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.pNext = &timeline_info;
+    submit_info.waitSemaphoreCount = batch_wait_semaphores.size();
+    submit_info.pWaitSemaphores = batch_wait_semaphores.data();
+    submit_info.pWaitDstStageMask = batch_wait_stages.data();
+    submit_info.commandBufferCount = batch.size();
+    submit_info.pCommandBuffers = batch.data();
+    submit_info.signalSemaphoreCount = 1;
+    submit_info.pSignalSemaphores = &timeline;
+
+    CHECK_VK(dispatch.queueSubmit(queue, 1, &submit_info, VK_NULL_HANDLE));
+
+    for (auto command_buffer : batch)
+      in_flight.push_back({command_buffer, signal_value});
+
+    batch.clear();
+    batch_wait_semaphores.clear();
+    batch_wait_values.clear();
+    batch_wait_stages.clear();
+
+    submitted_value = signal_value;
+    return {timeline, signal_value};
+  }
+
+  bool is_complete(vkb::DispatchTable &dispatch, SubmitTicket ticket) {
+    return completed_value(dispatch) >= ticket.value;
+  }
+
+  // Submits the pending batch first if the ticket belongs to it
+  void wait(vkb::DispatchTable &dispatch, SubmitTicket ticket) {
+    if (ticket.value > submitted_value)
+      submit(dispatch);
+
+    VkSemaphoreWaitInfo wait_info = {};
+    wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    wait_info.semaphoreCount = 1;
+    wait_info.pSemaphores = &timeline;
+    wait_info.pValues = &ticket.value;
+    CHECK_VK(dispatch.waitSemaphores(&wait_info, UINT64_MAX));
+
+    recycle(dispatch);
+  }
+};
+
+} // namespace b::engine
@@ -0,0 +1,453 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "bootstrap.hpp"
+
+namespace b::engine {
+
+// Persistently mapped host-visible buffer that uploads are written into
+// before being copied to device-local memory
+struct StagingRing {
+  VkBuffer buffer = VK_NULL_HANDLE;
+  VmaAllocation allocation = VK_NULL_HANDLE;
+  uint8_t *mapped = nullptr;
+  VkDeviceSize size = 0;
+  VkDeviceSize head = 0;
+  // Start of the data written since the last flush
+  VkDeviceSize flushed = 0;
+
+  void init(BootstrapInfo &bootstrap, VkDeviceSize ring_size) {
+    size = ring_size;
+
+    VkBufferCreateInfo buffer_info = {};
+    buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_info.size = size;
+    buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    VmaAllocationCreateInfo vmalloc_info = {};
+    vmalloc_info.usage = VMA_MEMORY_USAGE_AUTO_PREFER_HOST;
+    vmalloc_info.flags =
+        VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
+        VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+    VmaAllocationInfo allocation_info = {};
+    CHECK_VK(vmaCreateBuffer(bootstrap.allocator, &buffer_info, &vmalloc_info,
+                             &buffer, &allocation, &allocation_info));
+    mapped = (uint8_t *)allocation_info.pMappedData;
+    CHECK(mapped);
+  }
+
+  VkDeviceSize available() const { return size - head; }
+};
+
+// Uploads buffer contents to device-local memory. On UMA and ReBAR devices,
+// where device-local memory is host visible, the data is written directly.
+// Otherwise it goes through the staging ring and is copied on the transfer
+// queue, with the ownership released to the graphics queue family.
+//
+// Staged copies are batched and only submitted on flush, which has to happen
+// before the destination buffers are used. Flushing does not wait for the
+// copies, the ring is only rewound once the last flush has completed.
+//
+// Images are always staged. Their first mip level is copied on the transfer
+// queue and the others are blitted from it on the graphics queue, as
+// transfer queues cannot blit.
+struct Uploader {
+  struct PendingCopy {
+    VkBuffer dst_buffer;
+    VkBufferCopy region;
+    VkAccessFlags dst_access;
+    VkPipelineStageFlags dst_stage;
+  };
+
+  struct PendingImage {
+    VkImage image;
+    VkBufferImageCopy region;
+    uint32_t mip_levels;
+  };
+
+  StagingRing ring;
+  std::vector<PendingCopy> pending;
+  std::vector<PendingImage> pending_images;
+  SubmitTicket ring_ticket;
+
+  // Always stage, even if the destination memory is host visible
+  bool force_staging = false;
+
+  void init(BootstrapInfo &bootstrap, VkDeviceSize staging_size = 64 << 20) {
+    ring.init(bootstrap, staging_size);
+  }
+
+  void device_buffer_info(VkDeviceSize size, VkBufferUsageFlags usage,
+                          VkBufferCreateInfo &buffer_info,
+                          VmaAllocationCreateInfo &vmalloc_info) const {
+    buffer_info = {};
+    buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_info.size = size;
+    buffer_info.usage = usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    vmalloc_info = {};
+    vmalloc_info.usage = VMA_MEMORY_USAGE_AUTO;
+    vmalloc_info.flags =
+        VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
+        VMA_ALLOCATION_CREATE_HOST_ACCESS_ALLOW_TRANSFER_INSTEAD_BIT;
+    if (force_staging)
+      vmalloc_info.flags = 0;
+  }
+
+  // Device-local buffer that may end up host visible on UMA and ReBAR
+  // devices, in which case uploads write to it directly
+  void create_device_buffer(BootstrapInfo &bootstrap, VkDeviceSize size,
+                            VkBufferUsageFlags usage, VkBuffer *buffer,
+                            VmaAllocation *allocation) {
+    VkBufferCreateInfo buffer_info;
+    VmaAllocationCreateInfo vmalloc_info;
+    device_buffer_info(size, usage, buffer_info, vmalloc_info);
+
+    CHECK_VK(vmaCreateBuffer(bootstrap.allocator, &buffer_info, &vmalloc_info,
+                             buffer, allocation, nullptr));
+  }
+
+  // Heap that create_device_buffer would allocate from
+  uint32_t device_buffer_heap(BootstrapInfo &bootstrap, VkDeviceSize size,
+                              VkBufferUsageFlags usage) const {
+    VkBufferCreateInfo buffer_info;
+    VmaAllocationCreateInfo vmalloc_info;
+    device_buffer_info(size, usage, buffer_info, vmalloc_info);
+
+    uint32_t memory_type = 0;
+    CHECK_VK(vmaFindMemoryTypeIndexForBufferInfo(
+        bootstrap.allocator, &buffer_info, &vmalloc_info, &memory_type));
+
+    const VkPhysicalDeviceMemoryProperties *properties = nullptr;
+    vmaGetMemoryProperties(bootstrap.allocator, &properties);
+    return properties->memoryTypes[memory_type].heapIndex;
+  }
+
+  void create_buffer(BootstrapInfo &bootstrap, const void *data,
+                     VkDeviceSize size, VkBufferUsageFlags usage,
+                     VkBuffer *buffer, VmaAllocation *allocation) {
+    create_device_buffer(bootstrap, size, usage, buffer, allocation);
+    upload(bootstrap, *buffer, *allocation, 0, data, size,
+           usage_access(usage), usage_stage(usage));
+  }
+
+  void upload(BootstrapInfo &bootstrap, VkBuffer dst_buffer,
+              VmaAllocation dst_allocation, VkDeviceSize dst_offset,
+              const void *data, VkDeviceSize size, VkAccessFlags dst_access,
+              VkPipelineStageFlags dst_stage) {
+    VkMemoryPropertyFlags memory_flags = 0;
+    vmaGetAllocationMemoryProperties(bootstrap.allocator, dst_allocation,
+                                     &memory_flags);
+
+    bool host_visible = memory_flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+    if (host_visible && !force_staging) {
+      CHECK_VK(vmaCopyMemoryToAllocation(bootstrap.allocator, data,
+                                         dst_allocation, dst_offset, size));
+      return;
+    }
+
+    const uint8_t *src = (const uint8_t *)data;
+    while (size > 0) {
+      if (ring.available() == 0)
+        rewind(bootstrap);
+
+      VkDeviceSize chunk = std::min(size, ring.available());
+      std::memcpy(ring.mapped + ring.head, src, chunk);
+
+      PendingCopy copy = {};
+      copy.dst_buffer = dst_buffer;
+      copy.region.srcOffset = ring.head;
+      copy.region.dstOffset = dst_offset;
+      copy.region.size = chunk;
+      copy.dst_access = dst_access;
+      copy.dst_stage = dst_stage;
+      pending.push_back(copy);
+
+      // Keep the copies 16 byte aligned, which covers every index and vertex
+      // format
+      ring.head = std::min(ring.size, (ring.head + chunk + 15) & ~15ull);
+      src += chunk;
+      dst_offset += chunk;
+      size -= chunk;
+    }
+  }
+
+  // Stages the RGBA8 pixels of the first mip level. Once the flush's ticket
+  // completes every level is in SHADER_READ_ONLY_OPTIMAL, ready for the
+  // fragment shader.
+  void upload_image(BootstrapInfo &bootstrap, VkImage image, VkExtent2D extent,
+                    uint32_t mip_levels, const void *pixels) {
+    VkDeviceSize size = (VkDeviceSize)extent.width * extent.height * 4;
+    CHECK_REPORT_FMT(size <= ring.size,
+                     "A {}x{} image does not fit in the staging ring",
+                     extent.width, extent.height);
+    // Copied in one piece, unlike buffers
+    if (ring.available() < size)
+      rewind(bootstrap);
+    std::memcpy(ring.mapped + ring.head, pixels, size);
+
+    PendingImage pending_image = {};
+    pending_image.image = image;
+    pending_image.region.bufferOffset = ring.head;
+    pending_image.region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0,
+                                             1};
+    pending_image.region.imageExtent = {extent.width, extent.height, 1};
+    pending_image.mip_levels = mip_levels;
+    pending_images.push_back(pending_image);
+
+    ring.head = std::min(ring.size, (ring.head + size + 15) & ~15ull);
+  }
+
+  static VkImageMemoryBarrier image_barrier(VkImage image, uint32_t mip,
+                                            uint32_t mip_count,
+                                            VkImageLayout old_layout,
+                                            VkImageLayout new_layout,
+                                            VkAccessFlags src_access,
+                                            VkAccessFlags dst_access) {
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = src_access;
+    barrier.dstAccessMask = dst_access;
+    barrier.oldLayout = old_layout;
+    barrier.newLayout = new_layout;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, mip, mip_count, 0,
+                                1};
+    return barrier;
+  }
+
+  // Blits every level from the previous one, level 0 and the others have to
+  // be in TRANSFER_DST_OPTIMAL. RGBA8 supports linear blits on every device.
+  void cmd_generate_mips(BootstrapInfo &bootstrap,
+                         VkCommandBuffer command_buffer,
+                         const PendingImage &image) {
+    int32_t width = image.region.imageExtent.width;
+    int32_t height = image.region.imageExtent.height;
+
+    for (uint32_t mip = 1; mip < image.mip_levels; mip++) {
+      VkImageMemoryBarrier to_src = image_barrier(
+          image.image, mip - 1, 1, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+          VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT,
+          VK_ACCESS_TRANSFER_READ_BIT);
+      bootstrap.dispatch.cmdPipelineBarrier(
+          command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+          VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1,
+          &to_src);
+
+      VkImageBlit blit = {};
+      blit.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, mip - 1, 0, 1};
+      blit.srcOffsets[1] = {width, height, 1};
+      width = std::max(width / 2, 1);
+      height = std::max(height / 2, 1);
+      blit.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, mip, 0, 1};
+      blit.dstOffsets[1] = {width, height, 1};
+      bootstrap.dispatch.cmdBlitImage(
+          command_buffer, image.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+          image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit,
+          VK_FILTER_LINEAR);
+
+      VkImageMemoryBarrier to_read = image_barrier(
+          image.image, mip - 1, 1, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+          VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_TRANSFER_READ_BIT,
+          VK_ACCESS_SHADER_READ_BIT);
+      bootstrap.dispatch.cmdPipelineBarrier(
+          command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+          VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1,
+          &to_read);
+    }
+
+    VkImageMemoryBarrier last_to_read = image_barrier(
+        image.image, image.mip_levels - 1, 1,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT,
+        VK_ACCESS_SHADER_READ_BIT);
+    bootstrap.dispatch.cmdPipelineBarrier(
+        command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1,
+        &last_to_read);
+  }
+
+  void rewind(BootstrapInfo &bootstrap) {
+    bootstrap.wait(flush(bootstrap));
+    ring.head = 0;
+    ring.flushed = 0;
+  }
+
+  // Submits the batched copies, the ticket completes once the buffers and
+  // images are usable by the graphics queue
+  SubmitTicket flush(BootstrapInfo &bootstrap) {
+    if (pending.empty() && pending_images.empty())
+      return ring_ticket;
+
+    CHECK_VK(vmaFlushAllocation(bootstrap.allocator, ring.allocation,
+                                ring.flushed, ring.head - ring.flushed));
+
+    uint32_t graphics_family = bootstrap.graphics_queue_family();
+    bool transfer_ownership =
+        bootstrap.transfer_queue_family != graphics_family;
+
+    std::vector<VkBufferMemoryBarrier> barriers;
+    VkPipelineStageFlags dst_stages = 0;
+    for (auto &copy : pending) {
+      VkBufferMemoryBarrier barrier = {};
+      barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+      barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+      barrier.dstAccessMask = copy.dst_access;
+      barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      if (transfer_ownership) {
+        barrier.srcQueueFamilyIndex = bootstrap.transfer_queue_family;
+        barrier.dstQueueFamilyIndex = graphics_family;
+      }
+      barrier.buffer = copy.dst_buffer;
+      barrier.offset = copy.region.dstOffset;
+      barrier.size = copy.region.size;
+
+      barriers.push_back(barrier);
+      dst_stages |= copy.dst_stage;
+    }
+
+    // Level 0 of the images moves to the graphics queue for the blits, the
+    // other levels hold nothing yet and start out there
+    std::vector<VkImageMemoryBarrier> image_barriers;
+    for (auto &image : pending_images) {
+      VkImageMemoryBarrier barrier = image_barrier(
+          image.image, 0, 1, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT,
+          VK_ACCESS_TRANSFER_READ_BIT);
+      if (transfer_ownership) {
+        barrier.srcQueueFamilyIndex = bootstrap.transfer_queue_family;
+        barrier.dstQueueFamilyIndex = graphics_family;
+      }
+      image_barriers.push_back(barrier);
+    }
+    if (!pending_images.empty())
+      dst_stages |= VK_PIPELINE_STAGE_TRANSFER_BIT;
+
+    bootstrap.record_async(
+        vkb::QueueType::transfer, [&](VkCommandBuffer command_buffer) {
+          std::vector<VkImageMemoryBarrier> to_dst;
+          for (auto &image : pending_images)
+            to_dst.push_back(image_barrier(
+                image.image, 0, 1, VK_IMAGE_LAYOUT_UNDEFINED,
+                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0,
+                VK_ACCESS_TRANSFER_WRITE_BIT));
+          if (!to_dst.empty())
+            bootstrap.dispatch.cmdPipelineBarrier(
+                command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr,
+                to_dst.size(), to_dst.data());
+
+          for (auto &copy : pending)
+            bootstrap.dispatch.cmdCopyBuffer(command_buffer, ring.buffer,
+                                             copy.dst_buffer, 1, &copy.region);
+          for (auto &image : pending_images)
+            bootstrap.dispatch.cmdCopyBufferToImage(
+                command_buffer, ring.buffer, image.image,
+                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &image.region);
+
+          // The release half of the ownership transfer ignores the
+          // destination access, the acquire below takes care of it
+          std::vector<VkBufferMemoryBarrier> release = barriers;
+          std::vector<VkImageMemoryBarrier> image_release = image_barriers;
+          if (transfer_ownership) {
+            for (auto &barrier : release)
+              barrier.dstAccessMask = 0;
+            for (auto &barrier : image_release)
+              barrier.dstAccessMask = 0;
+          }
+
+          bootstrap.dispatch.cmdPipelineBarrier(
+              command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+              transfer_ownership ? VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT
+                                 : dst_stages,
+              0, 0, nullptr, release.size(), release.data(),
+              image_release.size(), image_release.data());
+          return VK_SUCCESS;
+        });
+    SubmitTicket ticket = bootstrap.submit_async(vkb::QueueType::transfer);
+
+    if (transfer_ownership || !pending_images.empty()) {
+      std::vector<VkImageMemoryBarrier> acquire;
+      if (transfer_ownership) {
+        for (auto &barrier : barriers)
+          barrier.srcAccessMask = 0;
+        acquire = image_barriers;
+        for (auto &barrier : acquire)
+          barrier.srcAccessMask = 0;
+      } else {
+        barriers.clear();
+      }
+      for (auto &image : pending_images)
+        if (image.mip_levels > 1)
+          acquire.push_back(image_barrier(
+              image.image, 1, image.mip_levels - 1, VK_IMAGE_LAYOUT_UNDEFINED,
+              VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0,
+              VK_ACCESS_TRANSFER_WRITE_BIT));
+
+      // The barrier's first scope has to match the wait stage, so the
+      // acquire and the layout transitions happen after the wait
+      bootstrap.graphics_submitter.wait_before_next_submit(ticket, dst_stages);
+      bootstrap.record_async(
+          vkb::QueueType::graphics, [&](VkCommandBuffer command_buffer) {
+            if (!barriers.empty() || !acquire.empty())
+              bootstrap.dispatch.cmdPipelineBarrier(
+                  command_buffer, dst_stages, dst_stages, 0, 0, nullptr,
+                  barriers.size(), barriers.data(), acquire.size(),
+                  acquire.data());
+            for (auto &image : pending_images)
+              cmd_generate_mips(bootstrap, command_buffer, image);
+            return VK_SUCCESS;
+          });
+      ticket = bootstrap.submit_async(vkb::QueueType::graphics);
+    }
+
+    pending.clear();
+    pending_images.clear();
+    ring.flushed = ring.head;
+    ring_ticket = ticket;
+    return ticket;
+  }
+
+  static VkAccessFlags usage_access(VkBufferUsageFlags usage) {
+    VkAccessFlags access = 0;
+    if (usage & VK_BUFFER_USAGE_VERTEX_BUFFER_BIT)
+      access |= VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+    if (usage & VK_BUFFER_USAGE_INDEX_BUFFER_BIT)
+      access |= VK_ACCESS_INDEX_READ_BIT;
+    if (usage & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT)
+      access |= VK_ACCESS_UNIFORM_READ_BIT;
+    if (usage & VK_BUFFER_USAGE_STORAGE_BUFFER_BIT)
+      access |= VK_ACCESS_SHADER_READ_BIT;
+    if (usage & VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT)
+      access |= VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+    return access;
+  }
+
+  static VkPipelineStageFlags usage_stage(VkBufferUsageFlags usage) {
+    VkPipelineStageFlags stage = 0;
+    if (usage & (VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+                 VK_BUFFER_USAGE_INDEX_BUFFER_BIT))
+      stage |= VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+    if (usage & (VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT |
+                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT))
+      stage |= VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+               VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+               VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    if (usage & VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT)
+      stage |= VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT;
+    return stage ? stage : VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+  }
+};
+
+} // namespace b::engine
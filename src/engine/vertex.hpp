@@ -1,41 +1,102 @@
 #pragma once
 
 #include <array>
+#include <cstring>
 
 #include <glm/glm.hpp>
 #include <vulkan/vulkan.h>
 
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "vertex_layout.hpp"
+
 namespace b::engine {
 
+// Full precision vertex, as meshes are authored, packed before the upload
 struct Vertex {
   glm::vec2 position;
   glm::vec3 color;
 
-  static VkVertexInputBindingDescription binding_description() {
-    VkVertexInputBindingDescription description = {};
-    description.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-    description.stride = sizeof(Vertex);
-    description.binding = 0;
+  static constexpr std::array<VertexAttribute, 2> attributes() {
+    return {VERTEX_ATTRIBUTE(Vertex, position),
+            VERTEX_ATTRIBUTE(Vertex, color)};
+  }
+};
+
+// Vertex as stored on the GPU, 8 bytes instead of 20. Half float positions
+// keep 11 bits of mantissa, plenty for meshes around the unit square.
+struct PackedVertex {
+  Half2 position;
+  Unorm8x4 color;
 
-    return description;
+  static constexpr std::array<VertexAttribute, 2> attributes() {
+    return {VERTEX_ATTRIBUTE(PackedVertex, position),
+            VERTEX_ATTRIBUTE(PackedVertex, color)};
   }
+};
+
+inline PackedVertex pack_vertex(const Vertex &vertex) {
+  return {pack_half2(vertex.position),
+          pack_unorm8x4(glm::vec4(vertex.color, 1.0f))};
+}
+
+#if defined(__x86_64__)
+// Two vertices per iteration, F16C is not part of the x86-64 baseline so the
+// caller checks for it
+__attribute__((target("f16c"))) inline void
+pack_vertices_f16c(const Vertex *src, PackedVertex *dst, size_t count) {
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 scale = _mm_set1_ps(255.0f);
 
-  static std::array<VkVertexInputAttributeDescription, 2>
-  attribute_descriptions() {
-    std::array<VkVertexInputAttributeDescription, 2> descriptions;
-    descriptions[0].binding = 0;
-    descriptions[0].location = 0;
-    descriptions[0].format = VK_FORMAT_R32G32_SFLOAT;
-    descriptions[0].offset = offsetof(Vertex, position);
+  size_t i = 0;
+  for (; i + 2 <= count; i += 2) {
+    const Vertex &a = src[i];
+    const Vertex &b = src[i + 1];
 
-    descriptions[1].binding = 0;
-    descriptions[1].location = 1;
-    descriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-    descriptions[1].offset = offsetof(Vertex, color);
+    __m128 positions =
+        _mm_setr_ps(a.position.x, a.position.y, b.position.x, b.position.y);
+    __m128i halves =
+        _mm_cvtps_ph(positions, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
 
-    return descriptions;
+    __m128 color_a = _mm_setr_ps(a.color.r, a.color.g, a.color.b, 1.0f);
+    __m128 color_b = _mm_setr_ps(b.color.r, b.color.g, b.color.b, 1.0f);
+    color_a = _mm_mul_ps(_mm_min_ps(_mm_max_ps(color_a, zero), one), scale);
+    color_b = _mm_mul_ps(_mm_min_ps(_mm_max_ps(color_b, zero), one), scale);
+    // Rounds to nearest with the default MXCSR, both fit in 8 bits
+    __m128i bytes = _mm_packus_epi16(
+        _mm_packs_epi32(_mm_cvtps_epi32(color_a), _mm_cvtps_epi32(color_b)),
+        _mm_setzero_si128());
+
+    uint32_t packed_halves[4], packed_colors[4];
+    _mm_storeu_si128((__m128i *)packed_halves, halves);
+    _mm_storeu_si128((__m128i *)packed_colors, bytes);
+
+    std::memcpy(&dst[i].position, &packed_halves[0], sizeof(Half2));
+    std::memcpy(&dst[i].color, &packed_colors[0], sizeof(Unorm8x4));
+    std::memcpy(&dst[i + 1].position, &packed_halves[1], sizeof(Half2));
+    std::memcpy(&dst[i + 1].color, &packed_colors[1], sizeof(Unorm8x4));
   }
-};
+
+  for (; i < count; i++)
+    dst[i] = pack_vertex(src[i]);
+}
+#endif
+
+inline void pack_vertices(const Vertex *src, PackedVertex *dst, size_t count) {
+#if defined(__x86_64__)
+  static const bool has_f16c = __builtin_cpu_supports("f16c");
+  if (has_f16c) {
+    pack_vertices_f16c(src, dst, count);
+    return;
+  }
+#endif
+
+  for (size_t i = 0; i < count; i++)
+    dst[i] = pack_vertex(src[i]);
+}
 
 const std::array<Vertex, 4> VERTICES = {
     Vertex{.position = {-0.5, -0.5}, .color = {1., 0., 0.}},
@@ -0,0 +1,181 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <glm/glm.hpp>
+#include <vulkan/vulkan.h>
+
+namespace b::engine {
+
+// Packed attribute types, each maps to the Vulkan format the vertex input
+// stage expands back to floats. Shaders keep declaring float inputs.
+
+// Two IEEE half floats
+struct Half2 {
+  uint16_t x, y;
+};
+
+// Two signed normalized 16-bit values in [-1, 1]
+struct Snorm16x2 {
+  int16_t x, y;
+};
+
+// Unit vector folded onto an octahedron, decoded in the shader
+struct OctNormal {
+  int16_t x, y;
+};
+
+// Four unsigned normalized 8-bit values in [0, 1]
+struct Unorm8x4 {
+  uint8_t r, g, b, a;
+};
+
+template <typename T> struct AttributeFormat;
+
+#define ATTRIBUTE_FORMAT(type, vk_format)                                      \
+  template <> struct AttributeFormat<type> {                                   \
+    static constexpr VkFormat format = vk_format;                              \
+  };
+
+ATTRIBUTE_FORMAT(float, VK_FORMAT_R32_SFLOAT)
+ATTRIBUTE_FORMAT(glm::vec2, VK_FORMAT_R32G32_SFLOAT)
+ATTRIBUTE_FORMAT(glm::vec3, VK_FORMAT_R32G32B32_SFLOAT)
+ATTRIBUTE_FORMAT(glm::vec4, VK_FORMAT_R32G32B32A32_SFLOAT)
+ATTRIBUTE_FORMAT(uint32_t, VK_FORMAT_R32_UINT)
+ATTRIBUTE_FORMAT(Half2, VK_FORMAT_R16G16_SFLOAT)
+ATTRIBUTE_FORMAT(Snorm16x2, VK_FORMAT_R16G16_SNORM)
+ATTRIBUTE_FORMAT(OctNormal, VK_FORMAT_R16G16_SNORM)
+ATTRIBUTE_FORMAT(Unorm8x4, VK_FORMAT_R8G8B8A8_UNORM)
+
+#undef ATTRIBUTE_FORMAT
+
+struct VertexAttribute {
+  uint32_t offset;
+  VkFormat format;
+};
+
+// Attribute of `member`, with the format derived from its type
+#define VERTEX_ATTRIBUTE(type, member)                                         \
+  VertexAttribute{offsetof(type, member),                                      \
+                  AttributeFormat<decltype(type::member)>::format}
+
+// Attribute of `member` read with an explicit format, e.g. a uint32_t holding
+// RGBA8
+#define VERTEX_ATTRIBUTE_AS(type, member, vk_format)                           \
+  VertexAttribute{offsetof(type, member), vk_format}
+
+// Binding and attribute descriptions of a vertex struct, derived from its
+// `static constexpr std::array<VertexAttribute, N> attributes()`. Locations
+// are assigned in declaration order.
+template <typename V> struct VertexLayout {
+  static constexpr size_t attribute_count = V::attributes().size();
+
+  static VkVertexInputBindingDescription binding_description(
+      uint32_t binding = 0,
+      VkVertexInputRate input_rate = VK_VERTEX_INPUT_RATE_VERTEX) {
+    VkVertexInputBindingDescription description = {};
+    description.inputRate = input_rate;
+    description.stride = sizeof(V);
+    description.binding = binding;
+
+    return description;
+  }
+
+  static std::array<VkVertexInputAttributeDescription, attribute_count>
+  attribute_descriptions(uint32_t binding = 0, uint32_t first_location = 0) {
+    constexpr auto attributes = V::attributes();
+
+    std::array<VkVertexInputAttributeDescription, attribute_count>
+        descriptions;
+    for (uint32_t i = 0; i < attribute_count; i++) {
+      descriptions[i].binding = binding;
+      descriptions[i].location = first_location + i;
+      descriptions[i].format = attributes[i].format;
+      descriptions[i].offset = attributes[i].offset;
+    }
+
+    return descriptions;
+  }
+};
+
+inline uint32_t index_type_size(VkIndexType index_type) {
+  return index_type == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t)
+                                            : sizeof(uint32_t);
+}
+
+// Round to nearest even, overflows to infinity
+inline uint16_t float_to_half(float value) {
+  const uint32_t f32_infinity = 255u << 23;
+  const uint32_t f16_max = (127u + 16u) << 23;
+  const uint32_t denormal_magic = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  uint32_t sign = bits & 0x80000000u;
+  bits ^= sign;
+
+  uint16_t half;
+  if (bits >= f16_max) {
+    half = bits > f32_infinity ? 0x7e00 : 0x7c00;
+  } else if (bits < (113u << 23)) {
+    // The float addition rounds the mantissa into place
+    float f, magic;
+    std::memcpy(&f, &bits, sizeof(f));
+    std::memcpy(&magic, &denormal_magic, sizeof(magic));
+    f += magic;
+    std::memcpy(&bits, &f, sizeof(bits));
+    half = bits - denormal_magic;
+  } else {
+    uint32_t mantissa_odd = (bits >> 13) & 1;
+    bits += ((15u - 127u) << 23) + 0xfff;
+    bits += mantissa_odd;
+    half = bits >> 13;
+  }
+
+  return half | (sign >> 16);
+}
+
+inline int16_t float_to_snorm16(float value) {
+  return (int16_t)std::lround(std::clamp(value, -1.0f, 1.0f) * 32767.0f);
+}
+
+inline uint8_t float_to_unorm8(float value) {
+  return (uint8_t)std::lround(std::clamp(value, 0.0f, 1.0f) * 255.0f);
+}
+
+inline Half2 pack_half2(glm::vec2 value) {
+  return {float_to_half(value.x), float_to_half(value.y)};
+}
+
+inline Snorm16x2 pack_snorm16x2(glm::vec2 value) {
+  return {float_to_snorm16(value.x), float_to_snorm16(value.y)};
+}
+
+inline Unorm8x4 pack_unorm8x4(glm::vec4 value) {
+  return {float_to_unorm8(value.r), float_to_unorm8(value.g),
+          float_to_unorm8(value.b), float_to_unorm8(value.a)};
+}
+
+// Decoded in GLSL with
+//   vec3 n = vec3 (e, 1.0 - abs (e.x) - abs (e.y));
+//   if (n.z < 0.0) n.xy = (1.0 - abs (n.yx)) * sign (n.xy);
+//   n = normalize (n);
+inline OctNormal encode_octahedral(glm::vec3 normal) {
+  normal /= std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+
+  glm::vec2 encoded = {normal.x, normal.y};
+  if (normal.z < 0.0f) {
+    glm::vec2 sign = {normal.x >= 0.0f ? 1.0f : -1.0f,
+                      normal.y >= 0.0f ? 1.0f : -1.0f};
+    encoded = (1.0f - glm::abs(glm::vec2(normal.y, normal.x))) * sign;
+  }
+
+  return {float_to_snorm16(encoded.x), float_to_snorm16(encoded.y)};
+}
+
+} // namespace b::engine
@@ -1,4 +1,10 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <vector>
 
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
@@ -10,24 +16,85 @@
 
 using namespace b;
 
-int main(void) {
+int main(int argc, char **argv) {
+  auto startup = std::chrono::steady_clock::now();
+
   engine::BootstrapInfo bootstrap;
+  engine::RenderData render_data;
+
+  // `--resize-stress <frames>` resizes the window every frame and reports the
+  // worst frame time, swapchain recreation must not stall. The frame pacing
+  // options can be changed from the overlay too, except for the frames in
+  // flight.
+  uint32_t resize_stress_frames = 0;
+  for (int i = 1; i < argc; i++) {
+    const char *option = argv[i];
+    if (std::strcmp(option, "--low-latency") == 0) {
+      render_data.pacer.low_latency = true;
+      continue;
+    }
+
+    CHECK_REPORT_FMT(i + 1 < argc, "Missing value for {}", option);
+    const char *value = argv[++i];
+    bool known_present_mode = true;
+    if (std::strcmp(option, "--resize-stress") == 0)
+      resize_stress_frames = std::strtoul(value, nullptr, 10);
+    else if (std::strcmp(option, "--present-mode") == 0)
+      known_present_mode =
+          engine::parse_present_mode(value, bootstrap.present_mode);
+    else if (std::strcmp(option, "--frames-in-flight") == 0)
+      render_data.MAX_FRAMES_IN_FLIGHT = std::strtoul(value, nullptr, 10);
+    else if (std::strcmp(option, "--fps-cap") == 0)
+      render_data.pacer.fps_cap = std::strtod(value, nullptr);
+    else if (std::strcmp(option, "--memory-dump") == 0)
+      render_data.memory.dump_path = value;
+    else
+      CHECK_REPORT_FMT(false, "Unknown argument {}", option);
+
+    CHECK_REPORT_FMT(known_present_mode,
+                     "Unknown present mode {}, expected immediate, mailbox "
+                     "or fifo",
+                     value);
+  }
+
   bootstrap.init();
   engine::GLFWwindow_show(bootstrap.window);
 
-  engine::RenderData render_data;
   render_data.init(bootstrap);
 
   engine::Library library;
+  library.init(bootstrap);
   auto mesh = library.add_mesh(
       bootstrap,
       std::vector(engine::VERTICES.cbegin(), engine::VERTICES.cend()),
       std::vector(engine::INDICES.cbegin(), engine::INDICES.cend()));
+  CHECK_REPORT_STR(mesh.valid(), "No memory for the scene mesh");
+  library.flush_uploads(bootstrap);
   engine::mesh = &mesh;
 
-  render_data.write_command_buffer(bootstrap);
+  // Checkerboard over the scene mesh, it appears once its upload completed
+  std::vector<uint32_t> checker(64 * 64);
+  for (uint32_t i = 0; i < checker.size(); i++)
+    checker[i] = ((i % 64) / 8 + (i / 64) / 8) % 2 ? 0xffffffff : 0xff808080;
+  render_data.scene_material = render_data.bindless.add_material(
+      {.texture = render_data.bindless.add_texture(bootstrap, checker.data(),
+                                                   64, 64)});
 
+  bool first_frame = true;
+  uint32_t frame = 0;
+  double max_frame_ms = 0.0, total_frame_ms = 0.0;
   while (!glfwWindowShouldClose(bootstrap.window)) {
+    auto frame_start = std::chrono::steady_clock::now();
+
+    if (resize_stress_frames > 0) {
+      if (frame == resize_stress_frames)
+        break;
+      float t = 0.5f + 0.5f * std::sin(frame * 0.1f);
+      glfwSetWindowSize(bootstrap.window, 640 + (int)(t * 640),
+                        480 + (int)(t * 480));
+    }
+
+    render_data.pace_frame(bootstrap);
     glfwPollEvents();
 
     ImGui_ImplVulkan_SetMinImageCount(
@@ -37,9 +104,48 @@ int main(void) {
     ImGui::NewFrame();
 
     ImGui::ShowDemoWindow();
+    render_data.profiler.draw_imgui();
+    render_data.memory.draw_imgui();
+    render_data.render_queue.draw_imgui();
+    if (render_data.cpu_culling)
+      render_data.culler.draw_imgui();
+    if (render_data.gpu_driven)
+      render_data.occlusion_culling =
+          render_data.gpu_scene.draw_imgui(render_data.occlusion_culling);
+    VkPresentModeKHR present_mode = bootstrap.present_mode;
+    if (render_data.pacer.draw_imgui(bootstrap.swapchain.present_mode,
+                                     present_mode,
+                                     render_data.MAX_FRAMES_IN_FLIGHT))
+      render_data.set_present_mode(bootstrap, present_mode);
 
     render_data.draw_frame(bootstrap);
+
+    if (first_frame) {
+      first_frame = false;
+      spdlog::info("First frame after {:.1f} ms ({} pipeline cache)",
+                   std::chrono::duration<double, std::milli>(
+                       std::chrono::steady_clock::now() - startup)
+                       .count(),
+                   bootstrap.pipeline_cache.warm ? "warm" : "cold");
+    }
+
+    double frame_ms = std::chrono::duration<double, std::milli>(
+                          std::chrono::steady_clock::now() - frame_start)
+                          .count();
+    // The first frame waits on pipeline compilation
+    if (frame > 0) {
+      max_frame_ms = std::max(max_frame_ms, frame_ms);
+      total_frame_ms += frame_ms;
+    }
+    frame++;
   }
 
+  if (resize_stress_frames > 0 && frame > 1)
+    spdlog::info("Resize stress: {} frames, {} swapchain recreations, "
+                 "{:.2f} ms average, {:.2f} ms max frame time",
+                 frame, render_data.swapchain_recreations,
+                 total_frame_ms / (frame - 1), max_frame_ms);
+
+  bootstrap.shutdown();
   return 0;
 }
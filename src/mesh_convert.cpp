@@ -0,0 +1,128 @@
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "engine/mesh_file.hpp"
+
+using namespace b;
+
+// Offline converter from Wavefront OBJ to the mesh files mapped by
+// Library::load_mesh.
+//
+//   sbox-mesh-convert [--no-optimize] <input.obj> <output.sbm>
+//
+// Only positions and the `v x y z r g b` vertex color extension are read,
+// z is dropped and vertices without a color are white. Polygons are
+// triangulated as fans.
+
+// OBJ indices start at 1, negative ones count back from the last vertex
+static bool parse_index(const std::string &token, size_t vertex_count,
+                        uint32_t &index) {
+  long value = std::strtol(token.c_str(), nullptr, 10);
+  if (value < 0)
+    value += vertex_count;
+  else
+    value -= 1;
+
+  if (value < 0 || (size_t)value >= vertex_count)
+    return false;
+  index = value;
+  return true;
+}
+
+static bool parse_obj(const char *path, std::vector<engine::Vertex> &vertices,
+                      std::vector<uint32_t> &indices) {
+  std::ifstream file(path);
+  if (!file) {
+    spdlog::error("Failed to open {}", path);
+    return false;
+  }
+
+  std::string line;
+  std::vector<uint32_t> polygon;
+  for (size_t line_number = 1; std::getline(file, line); line_number++) {
+    std::istringstream stream(line);
+    std::string keyword;
+    stream >> keyword;
+
+    if (keyword == "v") {
+      float values[6] = {0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f};
+      int count = 0;
+      while (count < 6 && stream >> values[count])
+        count++;
+      if (count < 2) {
+        spdlog::error("{}:{}: a vertex needs at least x and y", path,
+                      line_number);
+        return false;
+      }
+      // Without a color the defaults stay white
+      if (count < 6)
+        values[3] = values[4] = values[5] = 1.0f;
+
+      vertices.push_back({.position = {values[0], values[1]},
+                          .color = {values[3], values[4], values[5]}});
+    } else if (keyword == "f") {
+      polygon.clear();
+      std::string token;
+      while (stream >> token) {
+        // v, v/vt, v//vn or v/vt/vn, only v is used
+        uint32_t index;
+        if (!parse_index(token.substr(0, token.find('/')), vertices.size(),
+                         index)) {
+          spdlog::error("{}:{}: invalid vertex reference {}", path,
+                        line_number, token);
+          return false;
+        }
+        polygon.push_back(index);
+      }
+      if (polygon.size() < 3) {
+        spdlog::error("{}:{}: a face needs at least 3 vertices", path,
+                      line_number);
+        return false;
+      }
+
+      for (size_t i = 1; i + 1 < polygon.size(); i++)
+        indices.insert(indices.end(),
+                       {polygon[0], polygon[i], polygon[i + 1]});
+    }
+    // Normals, texture coordinates, groups and materials are ignored
+  }
+
+  return true;
+}
+
+int main(int argc, char **argv) {
+  bool optimize = true;
+  std::vector<const char *> paths;
+  for (int i = 1; i < argc; i++) {
+    if (std::strcmp(argv[i], "--no-optimize") == 0)
+      optimize = false;
+    else
+      paths.push_back(argv[i]);
+  }
+
+  if (paths.size() != 2) {
+    spdlog::error("Usage: {} [--no-optimize] <input.obj> <output.sbm>",
+                  argv[0]);
+    return 1;
+  }
+
+  std::vector<engine::Vertex> vertices;
+  std::vector<uint32_t> indices;
+  if (!parse_obj(paths[0], vertices, indices))
+    return 1;
+  if (indices.empty()) {
+    spdlog::error("{} has no faces", paths[0]);
+    return 1;
+  }
+
+  if (!engine::write_mesh_file(paths[1], vertices, std::move(indices),
+                               optimize))
+    return 1;
+  return 0;
+}
@@ -0,0 +1,30 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout (location = 0) in vec2 inPosition;
+layout (location = 1) in vec3 inColor;
+
+layout (location = 2) in vec2 inTranslation;
+layout (location = 3) in vec2 inScale;
+layout (location = 4) in float inRotation;
+layout (location = 5) in vec4 inInstanceColor;
+
+layout (set = 0, binding = 0) uniform Frame { mat4 viewProjection; };
+
+layout (location = 0) out vec3 fragColor;
+layout (location = 1) out vec2 fragUv;
+layout (location = 2) flat out uint fragMaterial;
+
+void main ()
+{
+	float s = sin (inRotation);
+	float c = cos (inRotation);
+	vec2 scaled = inPosition * inScale;
+	vec2 position = vec2 (c * scaled.x - s * scaled.y, s * scaled.x + c * scaled.y);
+
+	gl_Position = viewProjection * vec4 (position + inTranslation, 0.0, 1.0);
+	fragColor = inColor * inInstanceColor.rgb;
+	fragUv = inPosition + 0.5;
+	// Instances are tinted by their color, with the default material
+	fragMaterial = 0;
+}
@@ -0,0 +1,29 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+struct Object
+{
+	mat4 transform;
+	vec4 bounds;
+	// Index count, first index, vertex offset, material
+	uvec4 mesh;
+};
+
+layout (location = 0) in vec2 inPosition;
+layout (location = 1) in vec3 inColor;
+
+layout (set = 0, binding = 0) uniform Frame { mat4 viewProjection; };
+layout (std430, set = 2, binding = 0) readonly buffer Objects { Object objects[]; };
+
+layout (location = 0) out vec3 fragColor;
+layout (location = 1) out vec2 fragUv;
+layout (location = 2) flat out uint fragMaterial;
+
+void main ()
+{
+	Object object = objects[gl_InstanceIndex];
+	gl_Position = viewProjection * object.transform * vec4 (inPosition, 0.0, 1.0);
+	fragColor = inColor;
+	fragUv = inPosition + 0.5;
+	fragMaterial = object.mesh.w;
+}
@@ -1,8 +1,28 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
+#extension GL_EXT_nonuniform_qualifier : require
+
+struct Material
+{
+	vec4 baseColor;
+	// Bindless texture index
+	uvec4 texture;
+};
 
 layout (location = 0) in vec3 fragColor;
+layout (location = 1) in vec2 fragUv;
+layout (location = 2) flat in uint fragMaterial;
+
+layout (set = 1, binding = 0) uniform sampler textureSampler;
+layout (set = 1, binding = 1) uniform texture2D textures[];
+layout (std430, set = 1, binding = 2) readonly buffer Materials { Material materials[]; };
 
 layout (location = 0) out vec4 outColor;
 
-void main () { outColor = vec4 (fragColor, 1.0); }
+void main ()
+{
+	Material material = materials[fragMaterial];
+	// Draws merged into one indirect draw may use different textures
+	vec4 texel = texture (sampler2D (textures[nonuniformEXT (material.texture.x)], textureSampler), fragUv);
+	outColor = vec4 (fragColor, 1.0) * material.baseColor * texel;
+}
@@ -4,10 +4,24 @@
 layout (location = 0) in vec2 inPosition;
 layout (location = 1) in vec3 inColor;
 
+layout (set = 0, binding = 0) uniform Frame { mat4 viewProjection; };
+layout (std430, set = 0, binding = 1) readonly buffer Transforms { mat4 transforms[]; };
+
+layout (push_constant) uniform Draw
+{
+	uint object;
+	uint material;
+};
+
 layout (location = 0) out vec3 fragColor;
+layout (location = 1) out vec2 fragUv;
+layout (location = 2) flat out uint fragMaterial;
 
 void main ()
 {
-	gl_Position = vec4 (inPosition, 0.0, 1.0);
+	gl_Position = viewProjection * transforms[object] * vec4 (inPosition, 0.0, 1.0);
 	fragColor = inColor;
+	// Meshes have no texture coordinates, they are mapped across the unit square
+	fragUv = inPosition + 0.5;
+	fragMaterial = material;
 }